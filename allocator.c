@@ -0,0 +1,310 @@
+#include "allocator.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_MIN_SHIFT 6                      // smallest pooled block, 64 bytes
+#define POOL_MAX_SHIFT 20                     // largest pooled block, 1 MiB, bigger ones go straight to `malloc`
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define UNPOOLED POOL_CLASSES                 // size class of blocks too big to pool
+#define MAX_POOLED_BYTES (32u << 20)          // free memory a thread keeps cached, the rest is returned to the system
+
+/**
+ * Prefix of every block handed out by the pool or a budget, keeping what
+ * `free` and `realloc` need to know. 16 bytes, so the payload stays aligned like `malloc`'s.
+ */
+typedef struct {
+  size_t size;  // usable bytes
+  size_t sizeClass;
+} BlockHeader;
+
+/**
+ * A cached block of the pool, linked through its own payload
+ */
+typedef struct PooledBlock {
+  BlockHeader header;
+  struct PooledBlock* next;
+} PooledBlock;
+
+struct MemoryBudget {
+  JsonAllocator self;  // what `BudgetAllocator` returns
+  const JsonAllocator* parent;
+  size_t limit;
+  size_t used;
+  size_t peak;
+  char exceeded;
+};
+
+static void* pool_alloc(void* ctx, size_t size);
+static void* pool_realloc(void* ctx, void* ptr, size_t size);
+static void pool_free(void* ctx, void* ptr);
+static size_t size_class(size_t size);
+static void* budget_alloc(void* ctx, size_t size);
+static void* budget_realloc(void* ctx, void* ptr, size_t size);
+static void budget_free(void* ctx, void* ptr);
+static char charge(MemoryBudget* budget, size_t size);
+
+static const JsonAllocator threadPool = {pool_alloc, pool_realloc, pool_free, NULL};
+
+// Free lists are per thread, so pooled allocations never lock
+static _Thread_local PooledBlock* freeLists[POOL_CLASSES];
+static _Thread_local size_t pooledBytes = 0;
+
+/**
+ * `malloc` through `a`, or the C library when `a` is `NULL`.
+ */
+void* JsonAlloc(const JsonAllocator* a, size_t size) {
+  return a ? a->alloc(a->ctx, size) : malloc(size);
+}
+
+/**
+ * `calloc` through `a`, or the C library when `a` is `NULL`.
+ */
+void* JsonCalloc(const JsonAllocator* a, size_t count, size_t size) {
+  if (!a) return calloc(count, size);
+  if (size != 0 && count > SIZE_MAX / size) return NULL;
+
+  void* ptr = a->alloc(a->ctx, count * size);
+  if (ptr) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+/**
+ * `realloc` through `a`, or the C library when `a` is `NULL`.
+ */
+void* JsonRealloc(const JsonAllocator* a, void* ptr, size_t size) {
+  return a ? a->realloc(a->ctx, ptr, size) : realloc(ptr, size);
+}
+
+/**
+ * `free` through `a`, or the C library when `a` is `NULL`.
+ */
+void JsonFree(const JsonAllocator* a, void* ptr) {
+  if (!ptr) return;
+  if (a) {
+    a->free(a->ctx, ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+/**
+ * Allocator keeping freed blocks in per-thread free lists of power of two
+ * size classes (64 B to 1 MiB), so a thread validating document after
+ * document reuses the same warm memory instead of going back to `malloc`.
+ * Blocks may be freed by another thread, which then keeps them.
+ *
+ * @returns the allocator, shared by every thread
+ */
+const JsonAllocator* ThreadPoolAllocator(void) {
+  return &threadPool;
+}
+
+/**
+ * Returns the blocks the calling thread's pool keeps cached to the system.
+ */
+void FreeThreadPool(void) {
+  for (size_t i = 0; i < POOL_CLASSES; i++) {
+    while (freeLists[i]) {
+      PooledBlock* block = freeLists[i];
+      freeLists[i] = block->next;
+      free(block);
+    }
+  }
+  pooledBytes = 0;
+}
+
+/**
+ * Creates a budget of `limit` bytes over `parent` (the C library when `NULL`).
+ * Allocations through `BudgetAllocator` that would take the total in use past
+ * `limit` fail like an out of memory `malloc` would. A budget is not thread safe:
+ * give each document validated concurrently its own.
+ *
+ * @returns the budget, or `NULL` on failure
+ */
+MemoryBudget* CreateMemoryBudget(const JsonAllocator* parent, size_t limit) {
+  MemoryBudget* budget = (MemoryBudget*)JsonAlloc(parent, sizeof(MemoryBudget));
+  if (!budget) {
+    fprintf(stderr, "CreateMemoryBudget: failed to allocate budget!\n");
+    return NULL;
+  }
+
+  budget->self.alloc = budget_alloc;
+  budget->self.realloc = budget_realloc;
+  budget->self.free = budget_free;
+  budget->self.ctx = budget;
+  budget->parent = parent;
+  budget->limit = limit;
+  budget->used = 0;
+  budget->peak = 0;
+  budget->exceeded = 0;
+  return budget;
+}
+
+const JsonAllocator* BudgetAllocator(MemoryBudget* budget) {
+  return &budget->self;
+}
+
+/**
+ * @returns the most bytes (including block headers) `budget` ever had in use
+ */
+size_t BudgetPeak(const MemoryBudget* budget) {
+  return budget->peak;
+}
+
+/**
+ * Accounts `bytes` the document holds outside of `BudgetAllocator`, like the growth
+ * of the intern table, to `budget` for as long as the budget lives.
+ *
+ * @returns 0 on success, -1 if the budget would be exceeded
+ */
+char ChargeMemoryBudget(MemoryBudget* budget, size_t bytes) {
+  return charge(budget, bytes);
+}
+
+/**
+ * Releases `budget` itself. Whatever was allocated through it must be freed first.
+ */
+void FreeMemoryBudget(MemoryBudget* budget) {
+  if (budget) JsonFree(budget->parent, budget);
+}
+
+static void* pool_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  size_t cls = size_class(size);
+
+  BlockHeader* header;
+  if (cls != UNPOOLED && freeLists[cls]) {
+    PooledBlock* block = freeLists[cls];
+    freeLists[cls] = block->next;
+    pooledBytes -= (size_t)1 << (cls + POOL_MIN_SHIFT);
+    header = &block->header;
+  } else {
+    size_t blockSize = cls != UNPOOLED ? (size_t)1 << (cls + POOL_MIN_SHIFT) : sizeof(BlockHeader) + size;
+    if (blockSize < size) return NULL;  // overflowed
+    header = (BlockHeader*)malloc(blockSize);
+    if (!header) return NULL;
+  }
+
+  header->size = cls != UNPOOLED ? ((size_t)1 << (cls + POOL_MIN_SHIFT)) - sizeof(BlockHeader) : size;
+  header->sizeClass = cls;
+  return header + 1;
+}
+
+/**
+ * Grows or shrinks in place while the block's size class allows it,
+ * big blocks are handed to `realloc` to avoid a copy.
+ */
+static void* pool_realloc(void* ctx, void* ptr, size_t size) {
+  if (!ptr) return pool_alloc(ctx, size);
+
+  BlockHeader* header = (BlockHeader*)ptr - 1;
+  if (size <= header->size && (header->sizeClass == UNPOOLED || size_class(size) == header->sizeClass)) {
+    return ptr;
+  }
+
+  if (header->sizeClass == UNPOOLED && size_class(size) == UNPOOLED) {
+    if (sizeof(BlockHeader) + size < size) return NULL;
+    BlockHeader* grown = (BlockHeader*)realloc(header, sizeof(BlockHeader) + size);
+    if (!grown) return NULL;
+    grown->size = size;
+    return grown + 1;
+  }
+
+  void* moved = pool_alloc(ctx, size);
+  if (!moved) return NULL;
+  memcpy(moved, ptr, header->size < size ? header->size : size);
+  pool_free(ctx, ptr);
+  return moved;
+}
+
+static void pool_free(void* ctx, void* ptr) {
+  (void)ctx;
+  if (!ptr) return;
+
+  PooledBlock* block = (PooledBlock*)((BlockHeader*)ptr - 1);
+  size_t cls = block->header.sizeClass;
+  size_t blockSize = cls != UNPOOLED ? (size_t)1 << (cls + POOL_MIN_SHIFT) : 0;
+
+  if (cls == UNPOOLED || pooledBytes + blockSize > MAX_POOLED_BYTES) {
+    free(block);
+    return;
+  }
+
+  block->next = freeLists[cls];
+  freeLists[cls] = block;
+  pooledBytes += blockSize;
+}
+
+/**
+ * @returns the smallest size class whose blocks fit `size` bytes after their header, or `UNPOOLED`
+ */
+static size_t size_class(size_t size) {
+  if (size > ((size_t)1 << POOL_MAX_SHIFT) - sizeof(BlockHeader)) return UNPOOLED;
+
+  size_t cls = 0;
+  while (((size_t)1 << (cls + POOL_MIN_SHIFT)) - sizeof(BlockHeader) < size) cls++;
+  return cls;
+}
+
+static void* budget_alloc(void* ctx, size_t size) {
+  MemoryBudget* budget = (MemoryBudget*)ctx;
+  if (sizeof(BlockHeader) + size < size || charge(budget, sizeof(BlockHeader) + size) == -1) return NULL;
+
+  BlockHeader* header = (BlockHeader*)JsonAlloc(budget->parent, sizeof(BlockHeader) + size);
+  if (!header) {
+    budget->used -= sizeof(BlockHeader) + size;
+    return NULL;
+  }
+  header->size = size;
+  return header + 1;
+}
+
+static void* budget_realloc(void* ctx, void* ptr, size_t size) {
+  MemoryBudget* budget = (MemoryBudget*)ctx;
+  if (!ptr) return budget_alloc(ctx, size);
+
+  BlockHeader* header = (BlockHeader*)ptr - 1;
+  size_t old = header->size;
+  if (sizeof(BlockHeader) + size < size) return NULL;
+  if (size > old && charge(budget, size - old) == -1) return NULL;
+
+  BlockHeader* moved = (BlockHeader*)JsonRealloc(budget->parent, header, sizeof(BlockHeader) + size);
+  if (!moved) {
+    if (size > old) budget->used -= size - old;
+    return NULL;
+  }
+  if (size < old) budget->used -= old - size;
+  moved->size = size;
+  return moved + 1;
+}
+
+static void budget_free(void* ctx, void* ptr) {
+  MemoryBudget* budget = (MemoryBudget*)ctx;
+  if (!ptr) return;
+
+  BlockHeader* header = (BlockHeader*)ptr - 1;
+  budget->used -= sizeof(BlockHeader) + header->size;
+  JsonFree(budget->parent, header);
+}
+
+/**
+ * Accounts `size` more bytes to `budget`, refusing them past its limit.
+ *
+ * @returns 0 on success, -1 if the budget would be exceeded
+ */
+static char charge(MemoryBudget* budget, size_t size) {
+  if (size > budget->limit - budget->used) {
+    if (!budget->exceeded) {
+      fprintf(stderr, "MemoryBudget: document needs more than the %zu bytes allowed!\n", budget->limit);
+      budget->exceeded = 1;
+    }
+    return -1;
+  }
+
+  budget->used += size;
+  if (budget->used > budget->peak) budget->peak = budget->used;
+  return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <stddef.h>
+
+/**
+ * Where a document's memory comes from: the token stream, spans, key ids,
+ * key buffers and the parser's key sets all go through it.
+ * Same contract as `malloc`, `realloc` and `free`, plus the `ctx` given here.
+ * A `NULL` allocator means the C library's.
+ */
+typedef struct {
+  void* (*alloc)(void* ctx, size_t size);
+  void* (*realloc)(void* ctx, void* ptr, size_t size);
+  void (*free)(void* ctx, void* ptr);
+  void* ctx;
+} JsonAllocator;
+
+/**
+ * Opaque byte cap on everything allocated through `BudgetAllocator`
+ */
+typedef struct MemoryBudget MemoryBudget;
+
+void* JsonAlloc(const JsonAllocator* a, size_t size);
+void* JsonCalloc(const JsonAllocator* a, size_t count, size_t size);
+void* JsonRealloc(const JsonAllocator* a, void* ptr, size_t size);
+void JsonFree(const JsonAllocator* a, void* ptr);
+
+const JsonAllocator* ThreadPoolAllocator(void);
+void FreeThreadPool(void);
+
+MemoryBudget* CreateMemoryBudget(const JsonAllocator* parent, size_t limit);
+const JsonAllocator* BudgetAllocator(MemoryBudget* budget);
+size_t BudgetPeak(const MemoryBudget* budget);
+char ChargeMemoryBudget(MemoryBudget* budget, size_t bytes);
+void FreeMemoryBudget(MemoryBudget* budget);
+
+#endif
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+#include "batch.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "decompress.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+#include "uring.h"
+
+#define INITIAL_MAX_PATHS 64  // acceptable number of paths to initially hold in a `PathList`
+#define BATCH_CHUNK 16        // paths a worker claims at once, so small files don't contend on the counter
+#define MAX_OPEN_FDS 64       // directory handles `nftw` may keep open while walking
+#define READ_AHEAD 32         // files a worker keeps in flight through io_uring while it validates the oldest one
+#define MAX_READ_AHEAD_FILE (16u << 20)   // bigger files are streamed through `OpenJsonInput` instead
+#define MAX_READ_AHEAD_BYTES (64u << 20)  // buffered bytes a worker stops reading ahead at
+
+/**
+ * State shared by every worker of a `ValidateBatch` call
+ */
+typedef struct {
+  const PathList* list;
+  const JsonOptions* opts;
+  unsigned char* statuses;  // one `FileStatus` per path
+  atomic_size_t next;       // index of the first path no worker has claimed yet
+} BatchJob;
+
+/**
+ * Paths a worker claimed, `[next, last)` not handed out yet
+ */
+typedef struct {
+  size_t next;
+  size_t last;
+} Claim;
+
+/**
+ * A file a worker is reading ahead into memory
+ */
+typedef struct {
+  size_t pathIdx;
+  int fd;
+  char* data;
+  size_t size;
+  int res;      // what the ring answered: bytes read or a negated `errno`
+  char done;    // the ring answered
+  char direct;  // not read ahead, validated through `validate_file`
+} PendingRead;
+
+static void* validate_worker(void* arg);
+static size_t claim_path(BatchJob* job, Claim* claim);
+static void validate_ahead(BatchJob* job, Uring* ring);
+static void start_read(Uring* ring, const char* path, size_t pathIdx, uint64_t slot, PendingRead* r);
+static FileStatus finish_read(PendingRead* r, const char* path, const JsonOptions* opts);
+static FileStatus validate_file(const char* path, const JsonOptions* opts);
+static FileStatus validate_buffer(char* data, size_t size, const JsonOptions* opts);
+static int collect_json_file(const char* path, const struct stat* sb, int typeflag, struct FTW* ftwbuf);
+static char has_json_extension(const char* path);
+
+static PathList* walkList = NULL;  // `nftw` callbacks take no user pointer, so the list being filled lives here
+static char walkFailed = 0;
+
+/**
+ * Appends a copy of `path` to `list`.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char AddPath(PathList* list, const char* path) {
+  if (list->count == list->capacity) {
+    size_t newCapacity = list->capacity ? list->capacity * 2 : INITIAL_MAX_PATHS;
+    char** temp = (char**)JsonRealloc(list->allocator, list->paths, newCapacity * sizeof(char*));
+    if (!temp) {
+      fprintf(stderr, "AddPath: failed to realloc path list!\n");
+      return -1;
+    }
+    list->paths = temp;
+    list->capacity = newCapacity;
+  }
+
+  size_t len = strlen(path);
+  char* copy = (char*)JsonAlloc(list->allocator, len + 1);
+  if (!copy) {
+    fprintf(stderr, "AddPath: failed to copy path %s!\n", path);
+    return -1;
+  }
+  memcpy(copy, path, len + 1);
+
+  list->paths[list->count++] = copy;
+  return 0;
+}
+
+/**
+ * Recursively appends every regular `.json`, `.json.gz` or `.json.zst` file under `dir` to `list`.
+ * Symbolic links are not followed.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char AddDirectory(PathList* list, const char* dir) {
+  walkList = list;
+  walkFailed = 0;
+
+  int res = nftw(dir, collect_json_file, MAX_OPEN_FDS, FTW_PHYS);
+  walkList = NULL;
+
+  if (res != 0 || walkFailed) {
+    fprintf(stderr, "AddDirectory: failed to walk directory %s\n", dir);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Appends one path per line of `stream` to `list`, skipping empty lines.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char AddPathsFromStream(PathList* list, FILE* stream) {
+  char* line = NULL;
+  size_t lineCapacity = 0;
+  ssize_t len = 0;
+  char res = 0;
+
+  while ((len = getline(&line, &lineCapacity, stream)) != -1) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0) continue;
+
+    res = AddPath(list, line);
+    if (res == -1) break;
+  }
+
+  free(line);
+  return res;
+}
+
+void FreePathList(PathList* list) {
+  if (!list) {
+    return;
+  }
+  for (size_t i = 0; i < list->count; i++) {
+    JsonFree(list->allocator, list->paths[i]);
+  }
+  JsonFree(list->allocator, list->paths);
+  list->paths = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+/**
+ * Validates every file of `list` on `workers` threads (at most one per file).
+ * Each worker claims `BATCH_CHUNK` paths at a time and opens, reads, tokenizes
+ * and parses them itself. Where io_uring is available, a worker keeps the reads
+ * of its next `READ_AHEAD` files in flight while it validates the current one,
+ * so a single worker overlaps I/O with lexing. Otherwise it reads as it lexes,
+ * and only the other workers hide its I/O.
+ *
+ * Totals, the number of workers used and wall clock time are written to `summary`.
+ *
+ * @returns Heap allocated array with the `FileStatus` of each path on success, `NULL` on failure
+ */
+unsigned char* ValidateBatch(const PathList* list, size_t workers, const JsonOptions* opts, BatchSummary* summary) {
+  if (!list || list->count == 0) return NULL;
+  if (workers == 0) workers = 1;
+  if (workers > list->count) workers = list->count;
+
+  unsigned char* statuses = (unsigned char*)calloc(list->count, sizeof(unsigned char));
+  pthread_t* threads = (pthread_t*)malloc(workers * sizeof(pthread_t));
+  if (!statuses || !threads) {
+    fprintf(stderr, "ValidateBatch: failed to allocate worker state!\n");
+    free(statuses);
+    free(threads);
+    return NULL;
+  }
+
+  BatchJob job;
+  job.list = list;
+  job.opts = opts;
+  job.statuses = statuses;
+  atomic_init(&job.next, 0);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t started = 0;
+  for (; started < workers; started++) {
+    if (pthread_create(&threads[started], NULL, validate_worker, &job) != 0) {
+      fprintf(stderr, "ValidateBatch: failed to start worker %zu, continuing with %zu\n", started, started);
+      break;
+    }
+  }
+
+  // no thread could be started: validate on the calling thread instead
+  if (started == 0) {
+    validate_worker(&job);
+  }
+
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  free(threads);
+
+  if (summary) {
+    memset(summary, 0, sizeof(BatchSummary));
+    for (size_t i = 0; i < list->count; i++) {
+      if (statuses[i] == FILE_VALID) summary->valid++;
+      else if (statuses[i] == FILE_INVALID) summary->invalid++;
+      else summary->unreadable++;
+    }
+    summary->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    summary->workers = started > 0 ? started : 1;
+  }
+
+  return statuses;
+}
+
+static void* validate_worker(void* arg) {
+  BatchJob* job = (BatchJob*)arg;
+
+  Uring* ring = CreateUring(READ_AHEAD);
+  if (ring) {
+    validate_ahead(job, ring);
+    FreeUring(ring);
+  } else {
+    Claim claim = {0, 0};
+    size_t i;
+    while ((i = claim_path(job, &claim)) != SIZE_MAX) {
+      job->statuses[i] = validate_file(job->list->paths[i], job->opts);
+    }
+  }
+
+  FreeInternTable();  // this worker's keys
+  FreeThreadPool();
+  return NULL;
+}
+
+/**
+ * @returns the index of the next path this worker should validate, claiming
+ * `BATCH_CHUNK` more when `claim` ran out, or `SIZE_MAX` once every path is taken
+ */
+static size_t claim_path(BatchJob* job, Claim* claim) {
+  if (claim->next == claim->last) {
+    size_t count = job->list->count;
+    size_t first = atomic_fetch_add(&job->next, BATCH_CHUNK);
+    if (first >= count) return SIZE_MAX;
+
+    claim->next = first;
+    claim->last = first + BATCH_CHUNK < count ? first + BATCH_CHUNK : count;
+  }
+  return claim->next++;
+}
+
+/**
+ * Validates the paths this worker claims in order, with up to `READ_AHEAD` of
+ * the following files (and `MAX_READ_AHEAD_BYTES` of their contents) being read
+ * by `ring` in the meantime.
+ */
+static void validate_ahead(BatchJob* job, Uring* ring) {
+  PendingRead reads[READ_AHEAD];
+  Claim claim = {0, 0};
+  size_t oldest = 0;
+  size_t inFlight = 0;
+  size_t bufferedBytes = 0;
+  char claimedAll = 0;
+
+  for (;;) {
+    while (!claimedAll && inFlight < READ_AHEAD && (inFlight == 0 || bufferedBytes < MAX_READ_AHEAD_BYTES)) {
+      size_t i = claim_path(job, &claim);
+      if (i == SIZE_MAX) {
+        claimedAll = 1;
+        break;
+      }
+
+      size_t slot = (oldest + inFlight) % READ_AHEAD;
+      start_read(ring, job->list->paths[i], i, slot, &reads[slot]);
+      bufferedBytes += reads[slot].size;
+      inFlight++;
+    }
+    if (inFlight == 0) break;
+
+    PendingRead* r = &reads[oldest];
+    if (UringSubmit(ring) == 0) {
+      while (!r->done) {
+        uint64_t tag;
+        int res;
+        if (UringWait(ring, &tag, &res) == -1) break;
+        reads[tag].res = res;
+        reads[tag].done = 1;
+      }
+    }
+    if (!r->done) {
+      // the ring broke down: the kernel may still write into the buffers in flight, so leave them be
+      for (size_t n = 0; n < inFlight; n++) {
+        PendingRead* pending = &reads[(oldest + n) % READ_AHEAD];
+        if (pending->fd != -1) close(pending->fd);  // the ring holds its own reference to the file
+        if (pending->done) free(pending->data);
+        job->statuses[pending->pathIdx] = validate_file(job->list->paths[pending->pathIdx], job->opts);
+      }
+      size_t i;
+      while ((i = claim_path(job, &claim)) != SIZE_MAX) {
+        job->statuses[i] = validate_file(job->list->paths[i], job->opts);
+      }
+      return;
+    }
+
+    job->statuses[r->pathIdx] = finish_read(r, job->list->paths[r->pathIdx], job->opts);
+    bufferedBytes -= r->size;
+    oldest = (oldest + 1) % READ_AHEAD;
+    inFlight--;
+  }
+}
+
+/**
+ * Opens `path` and queues a read of all of it on `ring`, answered under `slot`.
+ * Files that cannot be read ahead (unopenable, empty, special or bigger than
+ * `MAX_READ_AHEAD_FILE`) are marked `direct` and left to `validate_file`.
+ */
+static void start_read(Uring* ring, const char* path, size_t pathIdx, uint64_t slot, PendingRead* r) {
+  r->pathIdx = pathIdx;
+  r->fd = -1;
+  r->data = NULL;
+  r->size = 0;
+  r->res = 0;
+  r->done = 1;
+  r->direct = 1;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0 || (size_t)st.st_size > MAX_READ_AHEAD_FILE) {
+    close(fd);
+    return;
+  }
+
+  char* data = (char*)malloc(st.st_size);
+  if (!data || UringQueueRead(ring, fd, data, st.st_size, slot) == -1) {
+    free(data);
+    close(fd);
+    return;
+  }
+
+  r->fd = fd;
+  r->data = data;
+  r->size = st.st_size;
+  r->done = 0;
+  r->direct = 0;
+}
+
+/**
+ * Validates the file `r` read ahead, finishing short reads (or reads the
+ * kernel's io_uring does not support) with `pread`.
+ * Compressed files go through `validate_file` to be decompressed.
+ */
+static FileStatus finish_read(PendingRead* r, const char* path, const JsonOptions* opts) {
+  if (r->direct) return validate_file(path, opts);
+
+  size_t got = r->res > 0 ? (size_t)r->res : 0;
+  while (got < r->size) {
+    ssize_t n = pread(r->fd, r->data + got, r->size - got, got);
+    if (n <= 0) break;
+    got += n;
+  }
+  close(r->fd);
+
+  FileStatus status;
+  if (got < r->size) {
+    status = FILE_UNREADABLE;
+  } else if (IsCompressedJson(r->data, r->size)) {
+    status = validate_file(path, opts);
+  } else {
+    status = validate_buffer(r->data, r->size, opts);
+  }
+  free(r->data);
+  return status;
+}
+
+static FileStatus validate_file(const char* path, const JsonOptions* opts) {
+  FILE* fp = OpenJsonInput(path);
+  if (!fp) {
+    return FILE_UNREADABLE;
+  }
+
+  TokenStream* ts = TokenizeWithOptions(fp, opts);
+  int res = Parse(ts);
+  char readFailed = ferror(fp) != 0;
+  fclose(fp);
+
+  if (readFailed) return FILE_UNREADABLE;
+  return res == 0 ? FILE_VALID : FILE_INVALID;
+}
+
+static FileStatus validate_buffer(char* data, size_t size, const JsonOptions* opts) {
+  FILE* fp = fmemopen(data, size, "r");
+  if (!fp) {
+    return FILE_UNREADABLE;
+  }
+
+  TokenStream* ts = TokenizeWithOptions(fp, opts);
+  int res = Parse(ts);
+  fclose(fp);
+  return res == 0 ? FILE_VALID : FILE_INVALID;
+}
+
+static int collect_json_file(const char* path, const struct stat* sb, int typeflag, struct FTW* ftwbuf) {
+  (void)sb;
+  (void)ftwbuf;
+
+  if (typeflag == FTW_DNR) {
+    fprintf(stderr, "AddDirectory: cannot read directory %s, skipping it\n", path);
+    return 0;
+  }
+  if (typeflag != FTW_F || !has_json_extension(path)) {
+    return 0;
+  }
+
+  if (AddPath(walkList, path) == -1) {
+    walkFailed = 1;
+    return 1;  // stop walking
+  }
+  return 0;
+}
+
+static char has_json_extension(const char* path) {
+  static const char* extensions[] = {".json", ".json.gz", ".json.zst"};
+
+  size_t len = strlen(path);
+  for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+    size_t extLen = strlen(extensions[i]);
+    if (len >= extLen && strcmp(path + len - extLen, extensions[i]) == 0) return 1;
+  }
+  return 0;
+}
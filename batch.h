@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stddef.h>
+#include <stdio.h>
+
+#include "options.h"
+
+/**
+ * Outcome of validating one file of a batch
+ */
+typedef enum {
+  FILE_VALID = 0,
+  FILE_INVALID,
+  FILE_UNREADABLE,
+} FileStatus;
+
+/**
+ * Growable list of heap allocated file paths.
+ * Zero-initialize it before the first `AddPath`, then set `allocator`
+ * to allocate the paths through it instead of the C library.
+ */
+typedef struct {
+  char** paths;
+  size_t count;
+  size_t capacity;
+  const JsonAllocator* allocator;
+} PathList;
+
+/**
+ * Totals of a `ValidateBatch` run
+ */
+typedef struct {
+  size_t valid;
+  size_t invalid;
+  size_t unreadable;
+  size_t workers;  // threads that actually validated, at most one per file
+  double seconds;
+} BatchSummary;
+
+char AddPath(PathList* list, const char* path);
+char AddDirectory(PathList* list, const char* dir);
+char AddPathsFromStream(PathList* list, FILE* stream);
+void FreePathList(PathList* list);
+
+unsigned char* ValidateBatch(const PathList* list, size_t workers, const JsonOptions* opts, BatchSummary* summary);
+
+#endif
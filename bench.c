@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+#include "build_config.h"
+#include "inplace.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+
+#define BENCH_RUNS 5  // each measurement is the best of this many runs
+#define SMALL_DOCUMENTS 100000  // documents validated back to back when comparing allocators
+
+/**
+ * An in-memory JSON document to benchmark.
+ */
+typedef struct {
+  const char* name;
+  char* data;
+  size_t len;
+} Corpus;
+
+static char make_records(Corpus* c, const char* name, size_t records, size_t keysPerRecord);
+static char load_file(Corpus* c, const char* name, const char* path);
+static double time_run(const Corpus* c, const JsonOptions* opts);
+static void bench_corpus(const Corpus* c);
+static char make_strings(Corpus* c, const char* name, size_t strings);
+static double time_strings(const Corpus* c, char inPlace);
+static int copy_strings(const SaxEvent* events, size_t count, void* ctx);
+static int touch_strings(const SaxEvent* events, size_t count, void* ctx);
+static double time_documents(const Corpus* c, const JsonAllocator* allocator);
+static double now_seconds(void);
+
+int main() {
+  Corpus corpora[3] = {0};
+
+  if (make_records(&corpora[0], "records, 16 keys", 100000, 16) == -1 ||
+      make_records(&corpora[1], "records, 256 keys", 4000, 256) == -1 ||
+      make_records(&corpora[2], "records, 4096 keys", 250, 4096) == -1) {
+    return -1;
+  }
+
+  Corpus ints = {0};
+  char haveInts = load_file(&ints, "2 million ints", "tests/custom/2_million_ints_4M.json") == 0;
+
+  printf("%-20s %10s %14s %14s %10s %12s\n", "corpus", "MiB", "default MB/s", "unique MB/s", "overhead", "shape hits");
+  for (size_t i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+    bench_corpus(&corpora[i]);
+    free(corpora[i].data);
+  }
+  if (haveInts) {
+    bench_corpus(&ints);
+    free(ints.data);
+  }
+
+  Corpus strings = {0};
+  if (make_strings(&strings, "escaped strings", 200000) == 0) {
+    double copied = time_strings(&strings, 0);
+    double inPlace = time_strings(&strings, 1);
+    double mb = strings.len / 1e6;
+    printf("\n%-20s %10s %14s %14s\n", "corpus", "MiB", "copy MB/s", "in place MB/s");
+    printf("%-20s %10.2f %14.1f %14.1f\n", strings.name, strings.len / (1024.0 * 1024.0), mb / copied, mb / inPlace);
+    free(strings.data);
+  }
+
+  Corpus small = {0};
+  if (make_records(&small, "small documents", 4, 16) == 0) {
+    double libc = time_documents(&small, NULL);
+    double pooled = time_documents(&small, ThreadPoolAllocator());
+    printf("\n%-20s %10s %14s %14s\n", "corpus", "bytes", "malloc docs/s", "pool docs/s");
+    printf("%-20s %10zu %14.0f %14.0f\n", small.name, small.len, SMALL_DOCUMENTS / libc, SMALL_DOCUMENTS / pooled);
+    free(small.data);
+  }
+
+  FreeThreadPool();
+  FreeInternTable();
+  return 0;
+}
+
+/**
+ * Builds an array of `records` objects, each with `keysPerRecord`
+ * distinct keys, the same ones in the same order for every record.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char make_records(Corpus* c, const char* name, size_t records, size_t keysPerRecord) {
+  char* data = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&data, &len);
+  if (!out) {
+    fprintf(stderr, RED "make_records: failed to open memstream!\n" RESET_COLOR);
+    return -1;
+  }
+
+  fputc('[', out);
+  for (size_t r = 0; r < records; r++) {
+    if (r > 0) fputc(',', out);
+    fputc('{', out);
+    for (size_t k = 0; k < keysPerRecord; k++) {
+      if (k > 0) fputc(',', out);
+      fprintf(out, "\"field_%zu\":%zu", k, r + k);
+    }
+    fputc('}', out);
+  }
+  fputc(']', out);
+  fclose(out);
+
+  c->name = name;
+  c->data = data;
+  c->len = len;
+  return 0;
+}
+
+/**
+ * Reads the whole file at `path` into `c`.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char load_file(Corpus* c, const char* name, const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) {
+    fprintf(stderr, RED "load_file: failed to open %s, skipping it\n" RESET_COLOR, path);
+    return -1;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+
+  char* data = (char*)malloc(size > 0 ? size : 1);
+  if (!data || fread(data, 1, size, fp) != (size_t)size) {
+    fprintf(stderr, RED "load_file: failed to read %s\n" RESET_COLOR, path);
+    free(data);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  c->name = name;
+  c->data = data;
+  c->len = size;
+  return 0;
+}
+
+/**
+ * Tokenizes and parses `c` `BENCH_RUNS` times.
+ *
+ * @returns the fastest run in seconds, or a negative number if `c` did not validate
+ */
+static double time_run(const Corpus* c, const JsonOptions* opts) {
+  double best = -1;
+
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    FILE* fp = fmemopen(c->data, c->len, "r");
+    if (!fp) return -1;
+
+    double start = now_seconds();
+    TokenStream* ts = TokenizeWithOptions(fp, opts);
+    int res = Parse(ts);
+    double elapsed = now_seconds() - start;
+    fclose(fp);
+
+    if (res != 0) return -1;
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+
+  return best;
+}
+
+static void bench_corpus(const Corpus* c) {
+  JsonOptions uniqueKeys = {0};
+  uniqueKeys.rejectDuplicateKeys = 1;
+
+  double plain = time_run(c, NULL);
+  FreeInternTable();  // so the shape stats only cover this corpus
+  double unique = time_run(c, &uniqueKeys);
+  if (plain < 0 || unique < 0) {
+    fprintf(stderr, RED "%s did not validate!\n" RESET_COLOR, c->name);
+    return;
+  }
+
+  ShapeStats stats;
+  GetShapeStats(&stats);
+  double mb = c->len / 1e6;
+  printf("%-20s %10.2f %14.1f %14.1f %9.1f%%", c->name, c->len / (1024.0 * 1024.0), mb / plain, mb / unique, (unique / plain - 1) * 100);
+  if (stats.transitions > 0) {
+    printf(" %11.1f%%\n", 100.0 * stats.cachedTransitions / stats.transitions);
+  } else {
+    printf(" %12s\n", "-");
+  }
+}
+
+/**
+ * Builds an array of `strings` 100 byte strings, a few of them escaped.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char make_strings(Corpus* c, const char* name, size_t strings) {
+  char* data = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&data, &len);
+  if (!out) {
+    fprintf(stderr, RED "make_strings: failed to open memstream!\n" RESET_COLOR);
+    return -1;
+  }
+
+  fputc('[', out);
+  for (size_t i = 0; i < strings; i++) {
+    if (i > 0) fputc(',', out);
+    fprintf(out, "\"record %08zu: the quick brown fox jumps over the lazy dog\\n\\u00e9t\\u00e9 \\\"quoted\\\" tail of it\"", i);
+  }
+  fputc(']', out);
+  fclose(out);
+
+  c->name = name;
+  c->data = data;
+  c->len = len;
+  return 0;
+}
+
+/**
+ * Materializes every string of `c`, either by copying each one out of the
+ * input and unescaping the copy, or by decoding them all in place.
+ *
+ * @returns the fastest run in seconds, or a negative number if `c` did not validate
+ */
+static double time_strings(const Corpus* c, char inPlace) {
+  double best = -1;
+  char* scratch = (char*)malloc(c->len);
+  if (!scratch) return -1;
+
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    memcpy(scratch, c->data, c->len);  // in place parsing destroys its input
+    int res = 0;
+    double start = now_seconds();
+
+    if (inPlace) {
+      SaxHandler handler = {touch_strings, scratch};
+      res = ParseInPlace(scratch, c->len, NULL, &handler);
+    } else {
+      FILE* fp = fmemopen(scratch, c->len, "r");
+      if (!fp) break;
+      SaxHandler handler = {copy_strings, scratch};
+      res = ParseStream(fp, NULL, &handler);
+      fclose(fp);
+    }
+
+    double elapsed = now_seconds() - start;
+    if (res != 0) {
+      best = -1;
+      break;
+    }
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+
+  free(scratch);
+  return best;
+}
+
+static int copy_strings(const SaxEvent* events, size_t count, void* ctx) {
+  const char* input = (const char*)ctx;
+  for (size_t i = 0; i < count; i++) {
+    if (events[i].type != SAX_STRING) continue;
+
+    size_t len = events[i].length - 2;  // without the quotation marks
+    char* copy = (char*)malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, input + events[i].offset + 1, len);
+    UnescapeInPlace(copy, len);
+    free(copy);
+  }
+  return 0;
+}
+
+static int touch_strings(const SaxEvent* events, size_t count, void* ctx) {
+  volatile char sink = 0;
+  const char* input = (const char*)ctx;
+  for (size_t i = 0; i < count; i++) {
+    if (events[i].type == SAX_STRING) sink = input[events[i].offset];
+  }
+  (void)sink;
+  return 0;
+}
+
+/**
+ * Validates `c` `SMALL_DOCUMENTS` times in a row with duplicate keys rejected,
+ * allocating through `allocator`, the way a server sees a stream of small requests.
+ *
+ * @returns the fastest run in seconds, or a negative number if `c` did not validate
+ */
+static double time_documents(const Corpus* c, const JsonAllocator* allocator) {
+  JsonOptions opts = {0};
+  opts.rejectDuplicateKeys = 1;
+  opts.allocator = allocator;
+  double best = -1;
+
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    double start = now_seconds();
+    for (size_t i = 0; i < SMALL_DOCUMENTS; i++) {
+      FILE* fp = fmemopen(c->data, c->len, "r");
+      if (!fp) return -1;
+      int res = Parse(TokenizeWithOptions(fp, &opts));
+      fclose(fp);
+      if (res != 0) return -1;
+    }
+    double elapsed = now_seconds() - start;
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+
+  return best;
+}
+
+static double now_seconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,396 @@
+#define _GNU_SOURCE
+#include "decompress.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define BLOCK_SIZE (256 * 1024)  // bytes of decompressed JSON per ring block
+#define BLOCK_COUNT 4            // blocks in the ring: the decompressor may run this far ahead of the lexer
+
+/**
+ * Compression formats recognized by their magic bytes
+ */
+typedef enum {
+  FORMAT_PLAIN = 0,
+  FORMAT_GZIP,
+  FORMAT_ZSTD,
+} Format;
+
+/**
+ * One slot of the ring, holding `len` decompressed bytes
+ */
+typedef struct {
+  char data[BLOCK_SIZE];
+  size_t len;
+} Block;
+
+/**
+ * A decompression pipeline: the `producer` thread fills blocks of `ring`
+ * while whoever reads the `FILE*` drains them, so both run at the same time.
+ *
+ * `head` is the next block to be filled, `tail` the one being read
+ * and `filled` how many blocks are ready between them.
+ */
+typedef struct {
+  FILE* compressed;
+  Format format;
+  Block ring[BLOCK_COUNT];
+  size_t head;
+  size_t tail;
+  size_t filled;
+  size_t readOffset;  // bytes of the `tail` block already handed to the reader
+  char finished;      // producer hit the end of the input
+  char failed;        // producer hit corrupt or truncated input
+  char stopping;      // reader closed the stream early
+  pthread_mutex_t lock;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+  pthread_t producer;
+} Pipeline;
+
+static Format detect_format(FILE* fp);
+static Format format_of(const unsigned char* magic, size_t n);
+static FILE* open_pipeline(FILE* compressed, Format format);
+static void* produce_blocks(void* arg);
+static Block* acquire_free_block(Pipeline* p);
+static void publish_block(Pipeline* p);
+static char decompress_gzip(Pipeline* p);
+static char decompress_zstd(Pipeline* p);
+static ssize_t pipeline_read(void* cookie, char* buf, size_t size);
+static int pipeline_close(void* cookie);
+
+/**
+ * Opens the JSON file at `path` for reading. Files starting with the gzip
+ * or zstd magic bytes are decompressed on a background thread while the
+ * returned stream is read, so decompression overlaps with lexing and parsing.
+ * Tokens split across decompressed blocks need no special care: the lexer
+ * only ever sees one continuous stream of characters.
+ *
+ * The result must be closed with `fclose`, whatever the format.
+ *
+ * @returns readable `FILE*` on success, `NULL` on failure
+ */
+FILE* OpenJsonInput(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) {
+    return NULL;
+  }
+
+  Format format = detect_format(fp);
+  if (format == FORMAT_PLAIN) {
+    return fp;
+  }
+
+  FILE* stream = open_pipeline(fp, format);
+  if (!stream) {
+    fclose(fp);
+    return NULL;
+  }
+  return stream;
+}
+
+/**
+ * @returns true if the `len` first bytes of a file, `head`, start
+ * like a compressed file `OpenJsonInput` would decompress
+ */
+char IsCompressedJson(const void* head, size_t len) {
+  return format_of((const unsigned char*)head, len) != FORMAT_PLAIN;
+}
+
+/**
+ * Peeks at the first bytes of `fp` and rewinds it.
+ */
+static Format detect_format(FILE* fp) {
+  unsigned char magic[4] = {0};
+  size_t n = fread(magic, 1, sizeof(magic), fp);
+  rewind(fp);
+  return format_of(magic, n);
+}
+
+static Format format_of(const unsigned char* magic, size_t n) {
+  if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+    return FORMAT_GZIP;
+  }
+  if (n >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) {
+    return FORMAT_ZSTD;
+  }
+  return FORMAT_PLAIN;
+}
+
+/**
+ * Starts the decompression thread for `compressed` and wraps
+ * the consuming end of the ring in a `FILE*`.
+ *
+ * @returns readable `FILE*` on success, `NULL` on failure
+ */
+static FILE* open_pipeline(FILE* compressed, Format format) {
+#ifndef HAVE_ZSTD
+  if (format == FORMAT_ZSTD) {
+    fprintf(stderr, "OpenJsonInput: zstd input requires building with HAVE_ZSTD!\n");
+    return NULL;
+  }
+#endif
+
+  Pipeline* p = (Pipeline*)calloc(1, sizeof(Pipeline));
+  if (!p) {
+    fprintf(stderr, "OpenJsonInput: failed to calloc pipeline!\n");
+    return NULL;
+  }
+
+  p->compressed = compressed;
+  p->format = format;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->notEmpty, NULL);
+  pthread_cond_init(&p->notFull, NULL);
+
+  if (pthread_create(&p->producer, NULL, produce_blocks, p) != 0) {
+    fprintf(stderr, "OpenJsonInput: failed to start decompression thread!\n");
+    goto on_error;
+  }
+
+  cookie_io_functions_t io = {0};
+  io.read = pipeline_read;
+  io.close = pipeline_close;
+
+  FILE* stream = fopencookie(p, "r", io);
+  if (!stream) {
+    fprintf(stderr, "OpenJsonInput: failed to open decompressed stream!\n");
+    pthread_mutex_lock(&p->lock);
+    p->stopping = 1;
+    pthread_cond_signal(&p->notFull);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->producer, NULL);
+    goto on_error;
+  }
+  return stream;
+
+on_error:
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->notEmpty);
+  pthread_cond_destroy(&p->notFull);
+  free(p);
+  return NULL;
+}
+
+static void* produce_blocks(void* arg) {
+  Pipeline* p = (Pipeline*)arg;
+  char res = p->format == FORMAT_GZIP ? decompress_gzip(p) : decompress_zstd(p);
+
+  pthread_mutex_lock(&p->lock);
+  p->finished = 1;
+  p->failed = res == -1;
+  pthread_cond_signal(&p->notEmpty);
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+/**
+ * Waits until the ring has room for one more block.
+ *
+ * @returns the block to fill, `NULL` if the reader is gone
+ */
+static Block* acquire_free_block(Pipeline* p) {
+  pthread_mutex_lock(&p->lock);
+  while (p->filled == BLOCK_COUNT && !p->stopping) {
+    pthread_cond_wait(&p->notFull, &p->lock);
+  }
+  Block* block = p->stopping ? NULL : &p->ring[p->head];
+  pthread_mutex_unlock(&p->lock);
+  return block;
+}
+
+/**
+ * Hands the block acquired last over to the reader.
+ */
+static void publish_block(Pipeline* p) {
+  pthread_mutex_lock(&p->lock);
+  p->head = (p->head + 1) % BLOCK_COUNT;
+  p->filled++;
+  pthread_cond_signal(&p->notEmpty);
+  pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * Inflates the gzip stream (including concatenated members) into the ring.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char decompress_gzip(Pipeline* p) {
+  // zlib takes over a duplicate of the descriptor so `pipeline_close` still owns `compressed`
+  int fd = dup(fileno(p->compressed));
+  gzFile gz = fd == -1 ? NULL : gzdopen(fd, "rb");
+  if (!gz) {
+    if (fd != -1) close(fd);
+    fprintf(stderr, "OpenJsonInput: failed to open gzip stream!\n");
+    return -1;
+  }
+  gzbuffer(gz, BLOCK_SIZE);
+
+  char res = 0;
+  for (;;) {
+    Block* block = acquire_free_block(p);
+    if (!block) break;
+
+    int n = gzread(gz, block->data, BLOCK_SIZE);
+    if (n < 0) {
+      int err = 0;
+      fprintf(stderr, "OpenJsonInput: corrupt gzip input: %s\n", gzerror(gz, &err));
+      res = -1;
+      break;
+    }
+    if (n == 0) {
+      // a gzip member cut short reads as a clean end of file, so check explicitly
+      int err = 0;
+      gzerror(gz, &err);
+      if (err != Z_OK) {
+        fprintf(stderr, "OpenJsonInput: truncated gzip input!\n");
+        res = -1;
+      }
+      break;
+    }
+
+    block->len = n;
+    publish_block(p);
+  }
+
+  gzclose(gz);
+  return res;
+}
+
+/**
+ * Decompresses the zstd stream (including concatenated frames) into the ring.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char decompress_zstd(Pipeline* p) {
+#ifdef HAVE_ZSTD
+  ZSTD_DStream* ds = ZSTD_createDStream();
+  size_t inCapacity = ZSTD_DStreamInSize();
+  char* inBuf = (char*)malloc(inCapacity);
+  if (!ds || !inBuf) {
+    fprintf(stderr, "OpenJsonInput: failed to set up zstd stream!\n");
+    ZSTD_freeDStream(ds);
+    free(inBuf);
+    return -1;
+  }
+  ZSTD_initDStream(ds);
+
+  char res = 0;
+  size_t lastRet = 0;  // 0 once a frame is fully decoded
+  ZSTD_inBuffer in = {inBuf, 0, 0};
+  Block* block = acquire_free_block(p);
+  ZSTD_outBuffer out = {block ? block->data : NULL, BLOCK_SIZE, 0};
+
+  while (block) {
+    if (in.pos == in.size) {
+      in.size = fread(inBuf, 1, inCapacity, p->compressed);
+      in.pos = 0;
+      if (in.size == 0) break;
+    }
+
+    lastRet = ZSTD_decompressStream(ds, &out, &in);
+    if (ZSTD_isError(lastRet)) {
+      fprintf(stderr, "OpenJsonInput: corrupt zstd input: %s\n", ZSTD_getErrorName(lastRet));
+      res = -1;
+      break;
+    }
+
+    if (out.pos == out.size) {
+      block->len = out.pos;
+      publish_block(p);
+      block = acquire_free_block(p);
+      out.dst = block ? block->data : NULL;
+      out.pos = 0;
+    }
+  }
+
+  // flush the partially filled last block
+  if (res == 0 && block && out.pos > 0) {
+    block->len = out.pos;
+    publish_block(p);
+  }
+  if (res == 0 && block && lastRet != 0) {
+    fprintf(stderr, "OpenJsonInput: truncated zstd input!\n");
+    res = -1;
+  }
+
+  ZSTD_freeDStream(ds);
+  free(inBuf);
+  return res;
+#else
+  (void)p;
+  return -1;
+#endif
+}
+
+/**
+ * `fopencookie` read hook: copies up to `size` decompressed bytes into `buf`,
+ * waiting for the producer when the ring is empty.
+ *
+ * @returns bytes copied, 0 at end of input, -1 on corrupt input
+ */
+static ssize_t pipeline_read(void* cookie, char* buf, size_t size) {
+  Pipeline* p = (Pipeline*)cookie;
+  size_t copied = 0;
+
+  pthread_mutex_lock(&p->lock);
+  while (copied < size) {
+    while (p->filled == 0 && !p->finished) {
+      pthread_cond_wait(&p->notEmpty, &p->lock);
+    }
+    if (p->filled == 0) break;  // producer is done and the ring is drained
+
+    Block* block = &p->ring[p->tail];
+    pthread_mutex_unlock(&p->lock);
+
+    // the tail block belongs to the reader until it is released below
+    size_t n = block->len - p->readOffset;
+    if (n > size - copied) n = size - copied;
+    memcpy(buf + copied, block->data + p->readOffset, n);
+    copied += n;
+    p->readOffset += n;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->readOffset == block->len) {
+      p->tail = (p->tail + 1) % BLOCK_COUNT;
+      p->filled--;
+      p->readOffset = 0;
+      pthread_cond_signal(&p->notFull);
+    }
+  }
+
+  char failed = p->failed && p->filled == 0;
+  pthread_mutex_unlock(&p->lock);
+
+  if (copied == 0 && failed) return -1;
+  return copied;
+}
+
+/**
+ * `fopencookie` close hook: stops the producer if it is still running and releases everything.
+ */
+static int pipeline_close(void* cookie) {
+  Pipeline* p = (Pipeline*)cookie;
+
+  pthread_mutex_lock(&p->lock);
+  p->stopping = 1;
+  pthread_cond_signal(&p->notFull);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->producer, NULL);
+
+  int res = fclose(p->compressed);
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->notEmpty);
+  pthread_cond_destroy(&p->notFull);
+  free(p);
+  return res;
+}
@@ -0,0 +1,8 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+#include <stdio.h>
+
+FILE* OpenJsonInput(const char* path);
+char IsCompressedJson(const void* head, size_t len);
+
+#endif
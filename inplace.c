@@ -0,0 +1,325 @@
+#include "inplace.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "lexer.h"
+#include "parser.h"
+
+#define REPLACEMENT_CHARACTER 0xFFFD  // stands in for lone UTF-16 surrogates, which have no UTF-8 encoding
+#define IN_PLACE_WINDOW_TOKENS 4096   // tokens `ParseInPlace` lexes at a time
+
+static size_t lex_escape(char* buf, size_t len, size_t* read, size_t write);
+static size_t unescape_one(char* str, size_t len, size_t* read, size_t write);
+static char is_hex4(const char* p);
+static uint32_t read_hex4(const char* p);
+static size_t put_utf8(char* out, uint32_t codepoint);
+
+/**
+ * Decodes the JSON escapes of the string contents `str[0, len)` (without the
+ * quotation marks, already validated by the lexer) in place, rewriting the
+ * decoded bytes over the escaped ones and appending a NUL terminator, so
+ * `str[len]` (the closing quotation mark) must be writable too.
+ * Escapes never expand, so the result always fits: `uXXXX` escapes become UTF-8,
+ * surrogate pairs are combined and lone surrogates become U+FFFD.
+ *
+ * Runs of bytes without a backslash are moved 16 at a time with SSE2,
+ * and left untouched until the first escape of the string.
+ *
+ * @returns the decoded length (excluding the terminator)
+ */
+size_t UnescapeInPlace(char* str, size_t len) {
+  size_t read = 0;
+  size_t write = 0;
+
+#ifdef __SSE2__
+  const __m128i backslash = _mm_set1_epi8('\\');
+  while (read + 16 <= len) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(str + read));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, backslash));
+
+    if (mask == 0) {
+      // `chunk` is already loaded, so storing it behind `read` cannot clobber unread bytes
+      if (write != read) _mm_storeu_si128((__m128i*)(str + write), chunk);
+      read += 16;
+      write += 16;
+      continue;
+    }
+
+    size_t skip = __builtin_ctz(mask);
+    if (write != read) memmove(str + write, str + read, skip);
+    read += skip;
+    write += skip;
+    write = unescape_one(str, len, &read, write);
+  }
+#endif
+
+  while (read < len) {
+    const char* backslashAt = (const char*)memchr(str + read, '\\', len - read);
+    size_t skip = backslashAt ? (size_t)(backslashAt - (str + read)) : len - read;
+    if (write != read) memmove(str + write, str + read, skip);
+    read += skip;
+    write += skip;
+    if (backslashAt) write = unescape_one(str, len, &read, write);
+  }
+
+  str[write] = '\0';
+  return write;
+}
+
+/**
+ * Validates the string whose contents start at `buf[*pos]`, just past its opening
+ * quotation mark, and decodes its escapes over it in the same pass, the way
+ * `UnescapeInPlace` would, NUL terminating the result. Strings are accepted
+ * exactly as `lexify_string` accepts them.
+ *
+ * Runs of 16 bytes holding no quotation mark, backslash or control character
+ * are skipped (or moved, once an escape shrank the string) at once with SSE2.
+ *
+ * @returns the decoded length with `*pos` just past the closing quotation mark,
+ * or `INVALID_STRING` with `*pos` just past the offending byte
+ */
+size_t LexStringInPlace(char* buf, size_t len, size_t* pos) {
+  const size_t start = *pos;
+  size_t read = start;
+  size_t write = start;
+
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i lastControl = _mm_set1_epi8(0x1F);
+#endif
+
+  for (;;) {
+#ifdef __SSE2__
+    while (read + 16 <= len) {
+      __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + read));
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+      special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(chunk, lastControl), lastControl));
+      int mask = _mm_movemask_epi8(special);
+
+      if (mask == 0) {
+        // `chunk` is already loaded, so storing it behind `read` cannot clobber unread bytes
+        if (write != read) _mm_storeu_si128((__m128i*)(buf + write), chunk);
+        read += 16;
+        write += 16;
+        continue;
+      }
+
+      size_t skip = __builtin_ctz(mask);
+      if (write != read) memmove(buf + write, buf + read, skip);
+      read += skip;
+      write += skip;
+      break;
+    }
+#endif
+
+    if (read == len) {
+      fprintf(stderr, "String was not terminated! Aborting.\n");
+      *pos = len;
+      return INVALID_STRING;
+    }
+
+    unsigned char ch = (unsigned char)buf[read];
+    if (ch == '"') {
+      buf[write] = '\0';
+      *pos = read + 1;
+      return write - start;
+    }
+
+    if (ch == '\\') {
+      write = lex_escape(buf, len, &read, write);
+      if (write == INVALID_STRING) {
+        *pos = read;
+        return INVALID_STRING;
+      }
+    } else if (ch > 0 && ch <= 0x1F) {
+      fprintf(stderr, "Control characters must be escaped!\n");
+      fprintf(stderr, "String was not terminated! Aborting.\n");
+      *pos = read + 1;
+      return INVALID_STRING;
+    } else {
+      buf[write++] = (char)ch;
+      read++;
+    }
+  }
+}
+
+/**
+ * Validates the JSON text in the mutable buffer `buf` of length `len` and
+ * decodes every string and key in place (see `LexStringInPlace`), overwriting
+ * the closing quotation mark or the freed bytes with a NUL terminator.
+ * `buf` is lexed directly, `IN_PLACE_WINDOW_TOKENS` tokens at a time, so
+ * besides the bytes it reads once, it costs one window of tokens and spans
+ * however long it is, and strings are decoded while they are lexed.
+ *
+ * If `handler` is not `NULL`, it receives the document's `SaxEvent`s, where
+ * `SAX_STRING` and `SAX_KEY` events locate the decoded, NUL terminated text
+ * inside `buf` instead of the raw token, so no string is ever copied out.
+ * `buf` is modified even if the document turns out to be invalid.
+ *
+ * @returns 0 for valid JSONs, -1 otherwise
+ */
+int ParseInPlace(char* buf, size_t len, const JsonOptions* opts, const SaxHandler* handler) {
+  if (!buf || len == 0) {
+    fprintf(stderr, "ParseInPlace: empty buffer!\n");
+    return -1;
+  }
+
+  JsonOptions withSpans = {0};
+  if (opts) withSpans = *opts;
+  if (handler) withSpans.recordSpans = 1;
+
+  Lexer* lexer = OpenBufferLexer(buf, len, &withSpans, IN_PLACE_WINDOW_TOKENS);
+  if (!lexer) return -1;
+  return ParseLexer(lexer, &withSpans, handler);
+}
+
+/**
+ * Validates the escape starting at `buf[*read]` (a backslash) like `lexify_string`
+ * does, then decodes it into `buf[write]` (see `unescape_one`).
+ *
+ * @returns the new `write` position, with `read` advanced past the escape,
+ * or `INVALID_STRING` with `read` just past the offending byte
+ */
+static size_t lex_escape(char* buf, size_t len, size_t* read, size_t write) {
+  size_t at = *read + 1;
+  int esc = at < len ? (unsigned char)buf[at] : EOF;
+
+  switch (esc) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      return unescape_one(buf, len, read, write);
+    case 'u':
+      for (at = *read + 2; at < *read + 6; at++) {
+        int digit = at < len ? (unsigned char)buf[at] : EOF;
+        if (!isxdigit(digit)) {
+          fprintf(stderr, "Invalid character in Unicode escape sequence: '%c' (expected hex digit).\n", digit);
+          *read = at < len ? at + 1 : len;
+          return INVALID_STRING;
+        }
+      }
+      return unescape_one(buf, len, read, write);
+    default:
+      fprintf(stderr, "Unexpected character after escape character ('\\'): %c.\n", esc);
+      fprintf(stderr, "Bad escape in string!\n");
+      fprintf(stderr, "String was not terminated! Aborting.\n");
+      *read += 1;
+      return INVALID_STRING;
+  }
+}
+
+/**
+ * Decodes the escape starting at `str[*read]` (a backslash) into `str[write]`.
+ *
+ * @returns the new `write` position, with `read` advanced past the escape
+ */
+static size_t unescape_one(char* str, size_t len, size_t* read, size_t write) {
+  char esc = str[*read + 1];
+  *read += 2;
+
+  switch (esc) {
+    case 'b':
+      str[write++] = '\b';
+      return write;
+    case 'f':
+      str[write++] = '\f';
+      return write;
+    case 'n':
+      str[write++] = '\n';
+      return write;
+    case 'r':
+      str[write++] = '\r';
+      return write;
+    case 't':
+      str[write++] = '\t';
+      return write;
+    case 'u':
+      break;
+    default:  // `"`, `\` and `/` stand for themselves
+      str[write++] = esc;
+      return write;
+  }
+
+  uint32_t codepoint = read_hex4(str + *read);
+  *read += 4;
+
+  if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+    // high surrogate: only meaningful when a `\uDC00`-`\uDFFF` low surrogate follows
+    uint32_t low = 0;
+    if (*read + 6 <= len && str[*read] == '\\' && str[*read + 1] == 'u' && is_hex4(str + *read + 2)) {
+      low = read_hex4(str + *read + 2);
+    }
+    if (low >= 0xDC00 && low <= 0xDFFF) {
+      codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+      *read += 6;
+    } else {
+      codepoint = REPLACEMENT_CHARACTER;
+    }
+  } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+    codepoint = REPLACEMENT_CHARACTER;
+  }
+
+  return write + put_utf8(str + write, codepoint);
+}
+
+/**
+ * @returns true if the 4 bytes at `p` are hexadecimal digits, which a
+ * lone surrogate's lookahead cannot assume since it was not lexed yet
+ */
+static char is_hex4(const char* p) {
+  for (int i = 0; i < 4; i++) {
+    if (!isxdigit((unsigned char)p[i])) return 0;
+  }
+  return 1;
+}
+
+static uint32_t read_hex4(const char* p) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    char ch = p[i];
+    uint32_t digit = (ch >= '0' && ch <= '9') ? (uint32_t)(ch - '0') : (uint32_t)((ch | 0x20) - 'a' + 10);
+    value = (value << 4) | digit;
+  }
+  return value;
+}
+
+/**
+ * Encodes `codepoint` as 1 to 4 bytes of UTF-8 into `out`.
+ *
+ * @returns how many bytes were written
+ */
+static size_t put_utf8(char* out, uint32_t codepoint) {
+  if (codepoint < 0x80) {
+    out[0] = (char)codepoint;
+    return 1;
+  }
+  if (codepoint < 0x800) {
+    out[0] = (char)(0xC0 | (codepoint >> 6));
+    out[1] = (char)(0x80 | (codepoint & 0x3F));
+    return 2;
+  }
+  if (codepoint < 0x10000) {
+    out[0] = (char)(0xE0 | (codepoint >> 12));
+    out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (codepoint & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (codepoint >> 18));
+  out[1] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (codepoint & 0x3F));
+  return 4;
+}
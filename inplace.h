@@ -0,0 +1,14 @@
+#ifndef INPLACE_H
+#define INPLACE_H
+#include <stddef.h>
+
+#include "options.h"
+#include "sax.h"
+
+#define INVALID_STRING ((size_t)-1)  // what `LexStringInPlace` returns for strings that are not valid JSON
+
+size_t UnescapeInPlace(char* str, size_t len);
+size_t LexStringInPlace(char* buf, size_t len, size_t* pos);
+int ParseInPlace(char* buf, size_t len, const JsonOptions* opts, const SaxHandler* handler);
+
+#endif
@@ -0,0 +1,413 @@
+#include "intern.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SLOTS 256          // power of two, so probing can mask instead of mod
+#define INITIAL_ARENA_BYTES 4096   // bytes of key text stored before the first realloc
+#define MAX_SHAPES (1u << 16)      // shapes a thread keeps, new layouts past this take the general path
+
+/**
+ * One distinct key. Its bytes live in `arena` at `[offset, offset + len)`.
+ */
+typedef struct {
+  size_t offset;
+  size_t len;
+  uint32_t hash;
+} InternEntry;
+
+/**
+ * The layout of an object so far (hidden-class style): the sequence of its
+ * keys, as a chain of transitions from an empty root shape. Objects found
+ * under the same member name (`pathKey`) start from the same root, so records
+ * of an array or NDJSON file keep walking the same few shapes.
+ */
+typedef struct {
+  uint32_t parent;  // `SHAPE_NONE` for roots
+  uint32_t key;     // key id that led here from `parent`, the path's key for roots
+  uint32_t next;    // the last transition taken out of this shape, tried before the table
+  uint32_t count;   // keys in the sequence
+} Shape;
+
+static char charge_growth(size_t oldBytes, size_t newBytes);
+static uint32_t hash_bytes(const char* bytes, size_t len);
+static char grow_slots(void);
+static uint32_t find_or_add_shape(uint32_t parent, uint32_t key);
+static char grow_shape_slots(void);
+static inline uint32_t hash_pair(uint32_t a, uint32_t b);
+
+// The table is per thread: no locking on the lexer's hot path, and ids are only
+// ever compared between keys lexified by the same thread
+static _Thread_local uint32_t* slots = NULL;  // open addressing table of `id + 1`, 0 marks an empty slot
+static _Thread_local size_t slotCount = 0;
+static _Thread_local InternEntry* entries = NULL;  // indexed by id
+static _Thread_local size_t entryCount = 0;
+static _Thread_local size_t entryCapacity = 0;
+static _Thread_local char* arena = NULL;  // every distinct key, stored once, back to back
+static _Thread_local size_t arenaSize = 0;
+static _Thread_local size_t arenaCapacity = 0;
+
+static _Thread_local Shape* shapes = NULL;  // indexed by shape id
+static _Thread_local size_t shapeCount = 0;
+static _Thread_local size_t shapeCapacity = 0;
+static _Thread_local uint32_t* shapeSlots = NULL;  // open addressing table of `shape id + 1` keyed by (`parent`, `key`)
+static _Thread_local size_t shapeSlotCount = 0;
+static _Thread_local uint32_t lastRootPath = SHAPE_NONE;  // `ShapeRoot`'s own one entry cache
+static _Thread_local uint32_t lastRoot = SHAPE_NONE;
+static _Thread_local ShapeStats stats = {0};
+static _Thread_local MemoryBudget* chargedBudget = NULL;  // see `ChargeInternTable`
+
+/**
+ * Looks up the key `bytes` of length `len` in the calling thread's intern table,
+ * inserting a copy of it the first time it is seen.
+ *
+ * Equal byte sequences always map to the same id, so callers can
+ * compare keys by id instead of by content.
+ *
+ * @returns the key's id on success, `INTERN_FAILED` if memory ran out
+ */
+uint32_t InternKey(const char* bytes, size_t len) {
+  if (!slots) {
+    if (charge_growth(0, INITIAL_SLOTS * sizeof(uint32_t)) == -1) return INTERN_FAILED;
+    slots = (uint32_t*)calloc(INITIAL_SLOTS, sizeof(uint32_t));
+    if (!slots) {
+      fprintf(stderr, "InternKey: failed to calloc slots!\n");
+      return INTERN_FAILED;
+    }
+    slotCount = INITIAL_SLOTS;
+  }
+
+  uint32_t hash = hash_bytes(bytes, len);
+  size_t mask = slotCount - 1;
+  size_t idx = hash & mask;
+
+  while (slots[idx] != 0) {
+    InternEntry* e = &entries[slots[idx] - 1];
+    if (e->hash == hash && e->len == len && (len == 0 || memcmp(arena + e->offset, bytes, len) == 0)) {
+      return slots[idx] - 1;
+    }
+    idx = (idx + 1) & mask;
+  }
+
+  // New key: copy its bytes into the arena
+  if (arenaSize + len > arenaCapacity) {
+    size_t newCapacity = arenaCapacity ? arenaCapacity : INITIAL_ARENA_BYTES;
+    while (arenaSize + len > newCapacity) newCapacity *= 2;
+    if (charge_growth(arenaCapacity, newCapacity) == -1) return INTERN_FAILED;
+    char* temp = (char*)realloc(arena, newCapacity);
+    if (!temp) {
+      fprintf(stderr, "InternKey: failed to realloc key arena!\n");
+      return INTERN_FAILED;
+    }
+    arena = temp;
+    arenaCapacity = newCapacity;
+  }
+
+  if (entryCount == entryCapacity) {
+    size_t newCapacity = entryCapacity ? entryCapacity * 2 : INITIAL_SLOTS / 2;
+    if (charge_growth(entryCapacity * sizeof(InternEntry), newCapacity * sizeof(InternEntry)) == -1) return INTERN_FAILED;
+    InternEntry* temp = (InternEntry*)realloc(entries, newCapacity * sizeof(InternEntry));
+    if (!temp) {
+      fprintf(stderr, "InternKey: failed to realloc entries!\n");
+      return INTERN_FAILED;
+    }
+    entries = temp;
+    entryCapacity = newCapacity;
+  }
+
+  if (len > 0) memcpy(arena + arenaSize, bytes, len);
+  uint32_t id = (uint32_t)entryCount;
+  entries[id].offset = arenaSize;
+  entries[id].len = len;
+  entries[id].hash = hash;
+  entryCount++;
+  arenaSize += len;
+  slots[idx] = id + 1;
+
+  // keep the load factor at or below 1/2 so probe sequences stay short
+  if (entryCount * 2 > slotCount && grow_slots() == -1) {
+    return INTERN_FAILED;
+  }
+
+  return id;
+}
+
+/**
+ * Returns the bytes of the key interned as `id`, writing its length to `len`.
+ * The pointer is only valid until the next `InternKey` call.
+ *
+ * @returns pointer to the key bytes, `NULL` for unknown ids
+ */
+const char* InternedKey(uint32_t id, size_t* len) {
+  if (id >= entryCount) return NULL;
+  if (len) *len = entries[id].len;
+  return arena + entries[id].offset;
+}
+
+/**
+ * @returns how many distinct keys the table holds
+ */
+size_t InternedKeyCount(void) {
+  return entryCount;
+}
+
+/**
+ * @returns the bytes the calling thread's intern table and shapes take up
+ */
+size_t InternTableBytes(void) {
+  return slotCount * sizeof(uint32_t) + entryCapacity * sizeof(InternEntry) + arenaCapacity +
+         shapeCapacity * sizeof(Shape) + shapeSlotCount * sizeof(uint32_t);
+}
+
+/**
+ * Counts every byte the calling thread's table grows by against `budget` until
+ * it is called again (with `NULL` to stop), failing interning once the budget is
+ * exhausted. The table outlives documents, so only their growth can be charged:
+ * the lexer sets this to the budget of the document it is lexing.
+ */
+void ChargeInternTable(MemoryBudget* budget) {
+  chargedBudget = budget;
+}
+
+/**
+ * Releases every key and shape interned by the calling thread and resets its `ShapeStats`.
+ * Ids handed out before are invalid afterwards.
+ */
+void FreeInternTable(void) {
+  free(slots);
+  free(entries);
+  free(arena);
+  slots = NULL;
+  entries = NULL;
+  arena = NULL;
+  slotCount = entryCount = entryCapacity = 0;
+  arenaSize = arenaCapacity = 0;
+
+  free(shapes);
+  free(shapeSlots);
+  shapes = NULL;
+  shapeSlots = NULL;
+  shapeCount = shapeCapacity = shapeSlotCount = 0;
+  lastRoot = lastRootPath = SHAPE_NONE;
+  memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @returns the empty shape objects found under the member name `pathKey` start from
+ * (`SHAPE_NONE` as `pathKey` for objects not under any member), or `SHAPE_NONE`
+ */
+uint32_t ShapeRoot(uint32_t pathKey) {
+  if (lastRoot != SHAPE_NONE && lastRootPath == pathKey) return lastRoot;
+
+  uint32_t root = find_or_add_shape(SHAPE_NONE, pathKey);
+  if (root < SHAPE_REPEATED) {
+    lastRoot = root;
+    lastRootPath = pathKey;
+  }
+  return root;
+}
+
+/**
+ * Extends `shape` with the member name `key`. Objects laid out like the last
+ * one that went through `shape` take the transition cached on it, without a table lookup.
+ *
+ * @returns the resulting shape, `SHAPE_REPEATED` if `key` already is in `shape`,
+ * or `SHAPE_NONE` if it can't be tracked (see `SHAPE_NONE`)
+ */
+uint32_t ShapeAfter(uint32_t shape, uint32_t key) {
+  if (shape >= shapeCount) return SHAPE_NONE;
+  stats.transitions++;
+
+  uint32_t next = shapes[shape].next;
+  if (next != SHAPE_NONE && shapes[next].key == key) {
+    stats.cachedTransitions++;
+    return next;
+  }
+
+  next = find_or_add_shape(shape, key);
+  if (next < SHAPE_REPEATED) shapes[shape].next = next;
+  return next;
+}
+
+/**
+ * Writes the member names of `shape` to `keys` (room for `MAX_SHAPE_KEYS`), last one first.
+ *
+ * @returns how many were written
+ */
+size_t ShapeKeys(uint32_t shape, uint32_t* keys) {
+  size_t count = 0;
+  while (shape < shapeCount && shapes[shape].parent != SHAPE_NONE) {
+    keys[count++] = shapes[shape].key;
+    shape = shapes[shape].parent;
+  }
+  return count;
+}
+
+/**
+ * `InternKey` for the member name that follows `shape`. When the key bytes
+ * equal those of the key `shape` transitioned to last time, its id is reused
+ * after a single `memcmp`, skipping the hash and the table probe.
+ *
+ * @returns the key's id on success, `INTERN_FAILED` if memory ran out
+ */
+uint32_t InternKeyInShape(uint32_t shape, const char* bytes, size_t len) {
+  stats.keys++;
+
+  if (shape < shapeCount && shapes[shape].next != SHAPE_NONE) {
+    uint32_t predicted = shapes[shapes[shape].next].key;
+    const InternEntry* e = &entries[predicted];
+    if (e->len == len && (len == 0 || memcmp(arena + e->offset, bytes, len) == 0)) {
+      stats.predictedKeys++;
+      return predicted;
+    }
+  }
+
+  return InternKey(bytes, len);
+}
+
+void GetShapeStats(ShapeStats* out) {
+  *out = stats;
+}
+
+/**
+ * Charges the table growing from `oldBytes` to `newBytes` to `chargedBudget`, if any.
+ *
+ * @returns 0 on success, -1 if the budget would be exceeded
+ */
+static char charge_growth(size_t oldBytes, size_t newBytes) {
+  if (!chargedBudget || newBytes <= oldBytes) return 0;
+  return ChargeMemoryBudget(chargedBudget, newBytes - oldBytes);
+}
+
+/**
+ * FNV-1a over the raw key bytes. Keys are short, so a simple byte-at-a-time
+ * hash beats anything that needs setup or a tail loop.
+ */
+static uint32_t hash_bytes(const char* bytes, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Doubles the slot table and reinserts every entry using its cached hash.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char grow_slots(void) {
+  size_t newCount = slotCount * 2;
+  if (charge_growth(slotCount * sizeof(uint32_t), newCount * sizeof(uint32_t)) == -1) return -1;
+  uint32_t* temp = (uint32_t*)calloc(newCount, sizeof(uint32_t));
+  if (!temp) {
+    fprintf(stderr, "InternKey: failed to grow slots!\n");
+    return -1;
+  }
+
+  size_t mask = newCount - 1;
+  for (size_t id = 0; id < entryCount; id++) {
+    size_t idx = entries[id].hash & mask;
+    while (temp[idx] != 0) idx = (idx + 1) & mask;
+    temp[idx] = (uint32_t)id + 1;
+  }
+
+  free(slots);
+  slots = temp;
+  slotCount = newCount;
+  return 0;
+}
+
+/**
+ * Looks up the shape reached from `parent` through `key`, creating it the first time.
+ *
+ * @returns its id, `SHAPE_REPEATED` or `SHAPE_NONE` (see `ShapeAfter`)
+ */
+static uint32_t find_or_add_shape(uint32_t parent, uint32_t key) {
+  if (!shapeSlots) {
+    if (charge_growth(0, INITIAL_SLOTS * sizeof(uint32_t)) == -1) return SHAPE_NONE;
+    shapeSlots = (uint32_t*)calloc(INITIAL_SLOTS, sizeof(uint32_t));
+    if (!shapeSlots) {
+      fprintf(stderr, "ShapeAfter: failed to calloc slots!\n");
+      return SHAPE_NONE;
+    }
+    shapeSlotCount = INITIAL_SLOTS;
+  }
+
+  size_t mask = shapeSlotCount - 1;
+  size_t idx = hash_pair(parent, key) & mask;
+  while (shapeSlots[idx] != 0) {
+    const Shape* s = &shapes[shapeSlots[idx] - 1];
+    if (s->parent == parent && s->key == key) return shapeSlots[idx] - 1;
+    idx = (idx + 1) & mask;
+  }
+
+  // New layout: only sequences without repeats, up to `MAX_SHAPE_KEYS`, become shapes
+  uint32_t count = 0;
+  if (parent != SHAPE_NONE) {
+    count = shapes[parent].count + 1;
+    if (count > MAX_SHAPE_KEYS) return SHAPE_NONE;
+    for (uint32_t s = parent; shapes[s].parent != SHAPE_NONE; s = shapes[s].parent) {
+      if (shapes[s].key == key) return SHAPE_REPEATED;
+    }
+  }
+  if (shapeCount == MAX_SHAPES) return SHAPE_NONE;
+
+  if (shapeCount == shapeCapacity) {
+    size_t newCapacity = shapeCapacity ? shapeCapacity * 2 : INITIAL_SLOTS / 2;
+    if (charge_growth(shapeCapacity * sizeof(Shape), newCapacity * sizeof(Shape)) == -1) return SHAPE_NONE;
+    Shape* temp = (Shape*)realloc(shapes, newCapacity * sizeof(Shape));
+    if (!temp) {
+      fprintf(stderr, "ShapeAfter: failed to realloc shapes!\n");
+      return SHAPE_NONE;
+    }
+    shapes = temp;
+    shapeCapacity = newCapacity;
+  }
+
+  uint32_t id = (uint32_t)shapeCount++;
+  shapes[id].parent = parent;
+  shapes[id].key = key;
+  shapes[id].next = SHAPE_NONE;
+  shapes[id].count = count;
+  shapeSlots[idx] = id + 1;
+
+  if (shapeCount * 2 > shapeSlotCount && grow_shape_slots() == -1) {
+    return SHAPE_NONE;
+  }
+  return id;
+}
+
+/**
+ * Doubles the shape slot table and reinserts every shape.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char grow_shape_slots(void) {
+  size_t newCount = shapeSlotCount * 2;
+  if (charge_growth(shapeSlotCount * sizeof(uint32_t), newCount * sizeof(uint32_t)) == -1) return -1;
+  uint32_t* temp = (uint32_t*)calloc(newCount, sizeof(uint32_t));
+  if (!temp) {
+    fprintf(stderr, "ShapeAfter: failed to grow slots!\n");
+    return -1;
+  }
+
+  size_t mask = newCount - 1;
+  for (size_t id = 0; id < shapeCount; id++) {
+    size_t idx = hash_pair(shapes[id].parent, shapes[id].key) & mask;
+    while (temp[idx] != 0) idx = (idx + 1) & mask;
+    temp[idx] = (uint32_t)id + 1;
+  }
+
+  free(shapeSlots);
+  shapeSlots = temp;
+  shapeSlotCount = newCount;
+  return 0;
+}
+
+static inline uint32_t hash_pair(uint32_t a, uint32_t b) {
+  uint64_t h = ((uint64_t)a << 32 | b) * 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(h >> 32);
+}
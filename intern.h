@@ -0,0 +1,39 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+#define INTERN_FAILED UINT32_MAX
+#define SHAPE_NONE UINT32_MAX            // no shape: the object is too big, the table is full, or memory ran out
+#define SHAPE_REPEATED (UINT32_MAX - 1)  // the key is already part of the shape
+#define MAX_SHAPE_KEYS 256               // longest key sequence kept as a shape, bigger objects take the general path
+
+/**
+ * How the calling thread's shapes fared since its table was last freed.
+ * Fields:
+ * - `transitions` / `cachedTransitions` shape steps taken, and how many of them the step cached on the shape answered
+ * - `keys` / `predictedKeys` keys interned along a shape, and how many matched the key the shape predicted
+ */
+typedef struct {
+  size_t transitions;
+  size_t cachedTransitions;
+  size_t keys;
+  size_t predictedKeys;
+} ShapeStats;
+
+uint32_t InternKey(const char* bytes, size_t len);
+const char* InternedKey(uint32_t id, size_t* len);
+size_t InternedKeyCount(void);
+size_t InternTableBytes(void);
+void ChargeInternTable(MemoryBudget* budget);
+void FreeInternTable(void);
+
+uint32_t ShapeRoot(uint32_t pathKey);
+uint32_t ShapeAfter(uint32_t shape, uint32_t key);
+size_t ShapeKeys(uint32_t shape, uint32_t* keys);
+uint32_t InternKeyInShape(uint32_t shape, const char* bytes, size_t len);
+void GetShapeStats(ShapeStats* stats);
+
+#endif
@@ -3,22 +3,92 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "build_config.h"
+#include "inplace.h"
+#include "intern.h"
 
 #define INITIAL_MAX_TOKENS 500  // acceptable number of tokens to initially read from the text file
+#define INITIAL_MAX_KEYS 64     // acceptable number of object keys to initially track when asked to
+#define INITIAL_STRING_BYTES 64  // bytes of string contents to initially buffer when tracking keys
+#define MAX_SHAPE_DEPTH 32       // nesting levels whose shapes predict member names, deeper keys are interned as usual
+#define MAX_INTERN_TABLE_BYTES (8u << 20)  // intern table kept between documents without a memory limit
 
+/**
+ * Growable byte buffer holding the raw (still escaped) contents of the last lexified string.
+ */
+typedef struct {
+  char* data;
+  size_t len;
+  size_t capacity;
+  char escaped;  // whether `data` holds any escape sequence
+  const JsonAllocator* allocator;
+} StringBuffer;
+
+/**
+ * The shape (see `ShapeRoot`) of every object the lexer is inside of, so the
+ * next member name can be checked against the one the shape predicts.
+ * Level 0 is outside of the root value. Brackets are trusted as they come,
+ * a mismatch only costs predictions since the parser rejects the document anyway.
+ */
+typedef struct {
+  uint32_t shapes[MAX_SHAPE_DEPTH + 1];    // `SHAPE_NONE` for arrays and untracked objects
+  uint32_t pathKeys[MAX_SHAPE_DEPTH + 1];  // member name each open container sits under
+  uint32_t lastKeys[MAX_SHAPE_DEPTH + 1];  // latest member name of each open object
+  char objects[MAX_SHAPE_DEPTH + 1];
+  size_t depth;
+} ShapeTracker;
+
+/**
+ * Everything needed to resume lexing where the previous window of tokens ended.
+ * `TokenizeWithOptions` runs one on its stack with a window that grows to hold the whole file.
+ */
+struct Lexer {
+  FILE* file;
+  char* data;      // what `OpenBufferLexer` lexes instead of `file`
+  size_t dataLen;
+  size_t stringStart;  // decoded contents of the latest string in `data`, in case it is a member name
+  size_t stringLen;
+  TokenStream window;  // tokens of the latest window, `tokenArray` and `spans` hold `capacity`
+  size_t capacity;
+  size_t keyCapacity;  // entries `window.keyIds` holds
+  size_t position;     // `position` of this lexer between windows
+  TOKEN previous;      // last token of the previous window
+  StringBuffer keyBuf;
+  StringBuffer* sb;  // `&keyBuf` when keys must be tracked, `NULL` otherwise
+  ShapeTracker tracker;
+  MemoryBudget* budget;
+  const JsonAllocator* allocator;  // the budget's when there is one
+  const JsonAllocator* owner;      // what the `Lexer` itself was allocated with
+};
+
+static char init_lexer(Lexer* lx, FILE* file, const JsonOptions* opts, size_t capacity);
+static char lex_tokens(Lexer* lx, char grow);
+static void release_lexer(Lexer* lx);
 static inline char is_whitespace(int ch);
 static inline char is_control_character(int ch);
-static char lexify_primitive_value(int currentChar, FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
-static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
+static char lexify_primitive_value(int currentChar, FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx, StringBuffer* sb);
+static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx, StringBuffer* sb);
+static char lexify_string_in_place(TOKEN* tokenArray, size_t* tokenBufIdx);
 static char lexify_number(int currentChar, FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
 static char lexify_true(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
 static char lexify_false(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
 static char lexify_null(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx);
+static inline int next_char(FILE* f);
+static inline void unread_char(int ch, FILE* f);
+static inline char append_char(StringBuffer* sb, int ch);
+static char record_key(Lexer* lx, char* name, size_t len, char escaped);
+static void enter_container(ShapeTracker* tracker, char isObject);
 int peek_next_char(FILE* file);
 static void print_token_stream(TokenStream* ts);
 
+static _Thread_local size_t position = 0;  // byte offset of the next char `next_char` returns
+static _Thread_local char* input = NULL;   // buffer `next_char` reads instead of its `FILE*`, if any
+static _Thread_local size_t inputLen = 0;
+static _Thread_local size_t tokenStart = 0;  // byte offset of the last lexified token
+static _Thread_local size_t tokenEnd = 0;  // byte offset just past the last lexified primitive value
+
 /**
  * Converts individual characters of `file`
  * into a meaningful stream of JSON tokens.
@@ -26,49 +96,260 @@ static void print_token_stream(TokenStream* ts);
  * @returns Heap allocated pointer to `TokenStream` on success, `NULL` on failure
  */
 TokenStream* Tokenize(FILE* file) {
-  TOKEN* tokenArray = NULL;
+  return TokenizeWithOptions(file, NULL);
+}
+
+/**
+ * Same as `Tokenize`, but honours `opts` (which may be `NULL`).
+ *
+ * With `opts->rejectDuplicateKeys` set, every string directly followed by
+ * a `NAME_SEPARATOR` is interned and its id appended to the stream's `keyIds`,
+ * so the parser can check member names without touching their bytes again.
+ *
+ * With `opts->recordSpans` set, the byte range of every token is stored in the stream's `spans`.
+ *
+ * Everything is allocated through `opts->allocator`. With `opts->memoryLimit` set,
+ * the stream gets its own `MemoryBudget` and tokenizing fails once it is exhausted.
+ * The intern table is kept per thread across documents: each one starts by resetting it
+ * when it holds more than half of `opts->memoryLimit`, or `MAX_INTERN_TABLE_BYTES` without one.
+ *
+ * @returns Heap allocated pointer to `TokenStream` on success, `NULL` on failure
+ */
+TokenStream* TokenizeWithOptions(FILE* file, const JsonOptions* opts) {
   TokenStream* ts = NULL;
+  Lexer lx;
+  if (init_lexer(&lx, file, opts, INITIAL_MAX_TOKENS) == -1) goto on_error;
+  if (lex_tokens(&lx, 1) == -1) goto on_error;
 
-  tokenArray = (TOKEN*)calloc(INITIAL_MAX_TOKENS, sizeof(TOKEN));
-  if (!tokenArray) {
-    fprintf(stderr, "tokenize: failed to calloc TOKEN* array!\n");
+  // avoid reading heap I don't own even though malloc(0) is valid (?) thanks valgrind
+  if (lx.window.size == 0) goto on_error;
+
+  ts = (TokenStream*)JsonAlloc(lx.allocator, sizeof(TokenStream));
+  if (!ts) {
+    fprintf(stderr, "tokenize: failed to malloc TokenStream!\n");
     goto on_error;
   }
 
-  size_t tokenBufIdx = 0;  // index of current `Token` in `tokenArray`
-  size_t capacity = INITIAL_MAX_TOKENS;
+  *ts = lx.window;
+  ts->budget = lx.budget;
+  JsonFree(lx.allocator, lx.keyBuf.data);
+
+#ifdef DEBUG
+  print_token_stream(ts);
+#endif
+
+  return ts;
+on_error:
+  release_lexer(&lx);
+  return NULL;
+}
+
+/**
+ * Starts lexing `file` a window of at most `windowTokens` tokens at a time (see `LexNextTokens`),
+ * honouring `opts` (which may be `NULL`) like `TokenizeWithOptions`.
+ * The lexer itself is allocated through `opts->allocator`, its windows through the budget
+ * of `opts->memoryLimit` when set.
+ *
+ * @returns Heap allocated `Lexer` on success, `NULL` on failure
+ */
+Lexer* OpenLexer(FILE* file, const JsonOptions* opts, size_t windowTokens) {
+  const JsonAllocator* owner = opts ? opts->allocator : NULL;
+  Lexer* lexer = (Lexer*)JsonAlloc(owner, sizeof(Lexer));
+  if (!lexer) {
+    fprintf(stderr, "OpenLexer: failed to malloc Lexer!\n");
+    return NULL;
+  }
+
+  if (init_lexer(lexer, file, opts, windowTokens > 0 ? windowTokens : 1) == -1) {
+    release_lexer(lexer);
+    JsonFree(owner, lexer);
+    return NULL;
+  }
+  lexer->owner = owner;
+  return lexer;
+}
+
+/**
+ * Lexifies the tokens following the previous window of `lexer`, as many as fit in it.
+ * The window's arrays are reused by the next call, and freed by `CloseLexer`:
+ * member name ids are the ones whose `NAME_SEPARATOR` is in this window.
+ *
+ * @returns the window, empty once the input is exhausted, `NULL` on failure
+ */
+TokenStream* LexNextTokens(Lexer* lexer) {
+  lexer->window.size = 0;
+  lexer->window.keyCount = 0;
+
+  // lexers can take turns on one thread, each resuming at its own offset
+  position = lexer->position;
+  char res = lex_tokens(lexer, 0);
+  lexer->position = position;
+  return res == 0 ? &lexer->window : NULL;
+}
+
+/**
+ * Same as `OpenLexer`, but lexes the `len` bytes of `buf` directly instead of going
+ * through stdio. Strings are decoded over `buf` as they are lexed (see `LexStringInPlace`),
+ * so the spans of `STRING` tokens locate their decoded, NUL terminated contents rather
+ * than the raw token. `buf` must outlive the lexer, and is modified even if lexing fails.
+ *
+ * @returns Heap allocated `Lexer` on success, `NULL` on failure
+ */
+Lexer* OpenBufferLexer(char* buf, size_t len, const JsonOptions* opts, size_t windowTokens) {
+  Lexer* lexer = OpenLexer(NULL, opts, windowTokens);
+  if (!lexer) return NULL;
+
+  lexer->data = buf;
+  lexer->dataLen = len;
+  return lexer;
+}
+
+void CloseLexer(Lexer* lexer) {
+  if (!lexer) return;
+  const JsonAllocator* owner = lexer->owner;
+  release_lexer(lexer);
+  JsonFree(owner, lexer);
+}
+
+/**
+ * Byte offset of the last char the latest `TokenizeWithOptions` or `LexNextTokens`
+ * on this thread consumed, which is the offending one when it failed.
+ */
+size_t TokenizeErrorOffset(void) {
+  return position > 0 ? position - 1 : 0;
+}
+
+/**
+ * Bytes the latest `TokenizeWithOptions` on this thread consumed,
+ * the whole (decompressed) input when it succeeded.
+ */
+size_t TokenizedBytes(void) {
+  return position;
+}
+
+/**
+ * Sets up `lx` to lex `file` from its start into a window of `capacity` tokens.
+ * `lx` can be passed to `release_lexer` even when this fails.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char init_lexer(Lexer* lx, FILE* file, const JsonOptions* opts, size_t capacity) {
+  memset(lx, 0, sizeof(Lexer));
+  lx->file = file;
+  lx->capacity = capacity;
+  lx->allocator = opts ? opts->allocator : NULL;
+  lx->tracker.pathKeys[0] = SHAPE_NONE;
+  position = 0;
+
+  if (opts && opts->memoryLimit > 0) {
+    lx->budget = CreateMemoryBudget(lx->allocator, opts->memoryLimit);
+    if (!lx->budget) return -1;
+    lx->allocator = BudgetAllocator(lx->budget);
+  }
+
+  lx->window.allocator = lx->allocator;
+  lx->keyBuf.allocator = lx->allocator;
+  if (opts && opts->rejectDuplicateKeys) {
+    lx->sb = &lx->keyBuf;
+
+    // the intern table outlives documents, so every document starts by resetting it once it
+    // takes up half of its budget (or `MAX_INTERN_TABLE_BYTES` without one), and what is
+    // left of it counts against this document like its growth will
+    size_t tableLimit = lx->budget ? opts->memoryLimit / 2 : MAX_INTERN_TABLE_BYTES;
+    if (InternTableBytes() > tableLimit) FreeInternTable();
+    if (lx->budget && ChargeMemoryBudget(lx->budget, InternTableBytes()) == -1) return -1;
+  }
+
+  lx->window.tokenArray = (TOKEN*)JsonCalloc(lx->allocator, capacity, sizeof(TOKEN));
+  if (!lx->window.tokenArray) {
+    fprintf(stderr, "tokenize: failed to calloc TOKEN* array!\n");
+    return -1;
+  }
+
+  if (opts && opts->recordSpans) {
+    lx->window.spans = (Span*)JsonAlloc(lx->allocator, capacity * sizeof(Span));
+    if (!lx->window.spans) {
+      fprintf(stderr, "tokenize: failed to malloc Span* array!\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Appends the tokens of `lx->file` (or `lx->data`) to `lx->window` until the input ends or
+ * the window is full, which with `grow` set makes it 1.5 times bigger instead.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char lex_tokens(Lexer* lx, char grow) {
+  FILE* file = lx->file;
+  StringBuffer* sb = lx->sb;  // only set when keys must be tracked
+  TOKEN* tokenArray = lx->window.tokenArray;
+  Span* spans = lx->window.spans;
+  size_t tokenBufIdx = lx->window.size;  // index of current `Token` in `tokenArray`
+  size_t capacity = lx->capacity;
+  char res = -1;
+  input = lx->data;
+  inputLen = lx->dataLen;
+  ChargeInternTable(lx->budget);
 
   int ch = 0;  // current unsigned character read from the JSON file
 
-  while ((ch = fgetc(file)) != EOF) {
+  for (;;) {
     // reallocate if JSON file is bigger than the original INITIAL_MAX_TOKENS
     if (tokenBufIdx == capacity) {
+      if (!grow) break;
+
       capacity *= 1.5;
-      TOKEN* temp = (TOKEN*)realloc(tokenArray, capacity * sizeof(TOKEN));
+      TOKEN* temp = (TOKEN*)JsonRealloc(lx->allocator, tokenArray, capacity * sizeof(TOKEN));
       if (!temp) {
         fprintf(stderr, "tokenize: failed to realloc TOKEN* array!\n");
-        goto on_error;
+        goto on_exit;
       }
       tokenArray = temp;
+
+      if (spans) {
+        Span* spansTemp = (Span*)JsonRealloc(lx->allocator, spans, capacity * sizeof(Span));
+        if (!spansTemp) {
+          fprintf(stderr, "tokenize: failed to realloc Span* array!\n");
+          goto on_exit;
+        }
+        spans = spansTemp;
+      }
     }
 
+    ch = next_char(file);
+    if (ch == EOF) break;
+
     // Ignore whitespace
     if (is_whitespace(ch)) {
       continue;
     }
 
+    tokenStart = position - 1;  // `ch` was already consumed
+
     // Handle "primitives": string, number, boolean and null
     char status = 0;
-    status = lexify_primitive_value(ch, file, tokenArray, &tokenBufIdx);
+    status = lexify_primitive_value(ch, file, tokenArray, &tokenBufIdx, sb);
     if (status == 0) {
-      goto on_error;
+      goto on_exit;
     } else if (status == 1) {
-      ch = fgetc(file);  // consume next char after lexifying a "primitive" value
+      if (spans) {
+        spans[tokenBufIdx - 1].offset = tokenStart;
+        spans[tokenBufIdx - 1].length = tokenEnd - tokenStart;
+      }
+      if (sb && input && tokenArray[tokenBufIdx - 1] == STRING) {
+        lx->stringStart = tokenStart;
+        lx->stringLen = tokenEnd - tokenStart;
+      }
+
+      ch = next_char(file);  // consume next char after lexifying a "primitive" value
       if (ch == EOF) break;
       if (is_whitespace(ch)) continue;
-      
+
       // Put char back and get it on next iteration, triggering realloc if needed
-      ungetc(ch, file);
+      unread_char(ch, file);
       continue;
     }
 
@@ -76,17 +357,27 @@ TokenStream* Tokenize(FILE* file) {
     switch (ch) {
       case BEGIN_ARRAY:
         tokenArray[tokenBufIdx] = BEGIN_ARRAY;
+        if (sb) enter_container(&lx->tracker, 0);
         break;
       case BEGIN_OBJECT:
         tokenArray[tokenBufIdx] = BEGIN_OBJECT;
+        if (sb) enter_container(&lx->tracker, 1);
         break;
       case END_ARRAY:
         tokenArray[tokenBufIdx] = END_ARRAY;
+        if (lx->tracker.depth > 0) lx->tracker.depth--;
         break;
       case END_OBJECT:
         tokenArray[tokenBufIdx] = END_OBJECT;
+        if (lx->tracker.depth > 0) lx->tracker.depth--;
         break;
       case NAME_SEPARATOR:
+        // the string right before a `:` is a member name, possibly the last token of the previous window
+        if (sb && (tokenBufIdx > 0 ? tokenArray[tokenBufIdx - 1] : lx->previous) == STRING) {
+          char recorded = input ? record_key(lx, input + lx->stringStart, lx->stringLen, 0)
+                                : record_key(lx, sb->data, sb->len, sb->escaped);
+          if (recorded == -1) goto on_exit;
+        }
         tokenArray[tokenBufIdx] = NAME_SEPARATOR;
         break;
       case VALUE_SEPARATOR:
@@ -94,33 +385,36 @@ TokenStream* Tokenize(FILE* file) {
         break;
       default:
         fprintf(stderr, "tokenize: unexpected token: %c (char), %d (decimal)\n", ch, ch);
-        goto on_error;
+        goto on_exit;
     }
 
+    if (spans) {
+      spans[tokenBufIdx].offset = tokenStart;
+      spans[tokenBufIdx].length = 1;
+    }
     tokenBufIdx++;
   }
+  res = 0;
+
+on_exit:
+  ChargeInternTable(NULL);
+  lx->window.tokenArray = tokenArray;
+  lx->window.spans = spans;
+  lx->window.size = tokenBufIdx;
+  lx->capacity = capacity;
+  if (tokenBufIdx > 0) lx->previous = tokenArray[tokenBufIdx - 1];
+  return res;
+}
 
-  // avoid reading heap I don't own even though malloc(0) is valid (?) thanks valgrind
-  if (tokenBufIdx == 0) goto on_error;
-
-  ts = (TokenStream*)malloc(sizeof(TokenStream));
-  if (!ts) {
-    fprintf(stderr, "tokenize: failed to malloc TokenStream!\n");
-    goto on_error;
-  }
-
-  ts->size = tokenBufIdx;
-  ts->tokenArray = tokenArray;
-
-#ifdef DEBUG
-  print_token_stream(ts);
-#endif
-
-  return ts;
-on_error:
-  if (tokenArray) free(tokenArray);
-  if (ts) free(ts);
-  return NULL;
+/**
+ * Frees everything `lx` allocated, but not `lx` itself.
+ */
+static void release_lexer(Lexer* lx) {
+  JsonFree(lx->allocator, lx->window.tokenArray);
+  JsonFree(lx->allocator, lx->window.spans);
+  JsonFree(lx->allocator, lx->window.keyIds);
+  JsonFree(lx->allocator, lx->keyBuf.data);
+  FreeMemoryBudget(lx->budget);  // `lx->allocator` lives in it, so it goes last
 }
 
 /**
@@ -133,7 +427,7 @@ on_error:
  *
  * Returns 0 on error, 1 on success, and -1 if the char didn't correspond to a primitive
  */
-static char lexify_primitive_value(int currentChar, FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
+static char lexify_primitive_value(int currentChar, FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx, StringBuffer* sb) {
   char status = -1;
 
   // Number
@@ -143,7 +437,7 @@ static char lexify_primitive_value(int currentChar, FILE* f, TOKEN* tokenArray,
   }
   // String
   else if (currentChar == '"') {
-    status = lexify_string(f, tokenArray, tokenBufIdx);
+    status = lexify_string(f, tokenArray, tokenBufIdx, sb);
   }
   // 'true'
   else if (currentChar == 't') {
@@ -204,7 +498,8 @@ static char lexify_number(int currentChar, FILE* f, TOKEN* tokenArray, size_t* t
   char isScanningExp = 0;
   int previousCh = 0;
 
-  ch = fgetc(f);
+  tokenEnd = position;
+  ch = next_char(f);
   while (ch != EOF) {
     // probable start of number's `frac`, lex the following chars as part of the number's fractional part
     if (ch == '.') {
@@ -246,13 +541,15 @@ static char lexify_number(int currentChar, FILE* f, TOKEN* tokenArray, size_t* t
     } else {
       if (!is_whitespace(ch)) {
         // end of the number: put back read char and stop lexing it
-        ungetc(ch, f);
+        unread_char(ch, f);
         break;
       }
     }
 
+    // whitespace is skipped by the loop above, but is not part of the number's span
+    if (!is_whitespace(ch)) tokenEnd = position;
     previousCh = ch;
-    ch = fgetc(f);
+    ch = next_char(f);
   }
 
   if (foundDecimalPoint && !fracPartHasNumbers) {
@@ -298,17 +595,26 @@ static char lexify_number(int currentChar, FILE* f, TOKEN* tokenArray, size_t* t
  * - control characters (`0x00` through `0x1F`)
  * - backslash (`\`)
  *
+ * If `sb` is not `NULL`, the raw bytes between the quotation marks are copied into it.
+ *
  * @returns 1 on success, 0 on error
  */
-static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
+static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx, StringBuffer* sb) {
+  if (input) return lexify_string_in_place(tokenArray, tokenBufIdx);
   if (!f || !tokenArray) return 0;
 
   int ch = 0;
   char foundStrEnd = 0;
+  if (sb) {
+    sb->len = 0;
+    sb->escaped = 0;
+  }
 
-  while ((ch = fgetc(f)) != EOF) {
+  while ((ch = next_char(f)) != EOF) {
     // Escapes
     if (ch == '\\') {
+      if (sb && append_char(sb, ch) == -1) return 0;
+      if (sb) sb->escaped = 1;
       ch = peek_next_char(f);
       char isEscapeOk = 0;
 
@@ -325,14 +631,16 @@ static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
           break;
         case 'u':  // uXXXX
           // expect 4 hexadecimal digits for Unicode
-          ch = fgetc(f);  // consume 'u'
+          ch = next_char(f);  // consume 'u'
+          if (sb && append_char(sb, ch) == -1) return 0;
           for (int i = 0; i < 4; i++) {
-            ch = fgetc(f);
+            ch = next_char(f);
 
             if (!isxdigit(ch)) {
               fprintf(stderr, "Invalid character in Unicode escape sequence: '%c' (expected hex digit).\n", ch);
               return 0;
             }
+            if (sb && append_char(sb, ch) == -1) return 0;
           }
 
           continue;
@@ -342,7 +650,8 @@ static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
       }
 
       if (isEscapeOk) {
-        fgetc(f);  // consume it
+        next_char(f);  // consume it
+        if (sb && append_char(sb, ch) == -1) return 0;
         continue;
       } else {
         fprintf(stderr, "Bad escape in string!\n");
@@ -360,11 +669,16 @@ static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
       foundStrEnd = 1;
       break;
     }
+
+    else if (sb && append_char(sb, ch) == -1) {
+      return 0;
+    }
   }
 
   if (foundStrEnd) {
     tokenArray[*tokenBufIdx] = STRING;
     (*tokenBufIdx)++;
+    tokenEnd = position;
     return 1;
   } else {
     fprintf(stderr, "String was not terminated! Aborting.\n");
@@ -372,17 +686,36 @@ static char lexify_string(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
   }
 }
 
+/**
+ * `lexify_string` for buffer lexers: validates the string and decodes it over `input`
+ * in a single pass (see `LexStringInPlace`). Its token then spans the decoded contents.
+ *
+ * @returns 1 on success, 0 on error
+ */
+static char lexify_string_in_place(TOKEN* tokenArray, size_t* tokenBufIdx) {
+  size_t start = position;
+  size_t decoded = LexStringInPlace(input, inputLen, &position);
+  if (decoded == INVALID_STRING) return 0;
+
+  tokenArray[*tokenBufIdx] = STRING;
+  (*tokenBufIdx)++;
+  tokenStart = start;
+  tokenEnd = start + decoded;
+  return 1;
+}
+
 /**
  * Attempts to lexify the `true` JSON literal.
  * @returns 1 on success, 0 on error
  */
 static char lexify_true(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
   int ch = 0;
-  if ((ch = fgetc(f)) == 'r' &&
-      (ch = fgetc(f)) == 'u' &&
-      (ch = fgetc(f)) == 'e') {
+  if ((ch = next_char(f)) == 'r' &&
+      (ch = next_char(f)) == 'u' &&
+      (ch = next_char(f)) == 'e') {
     tokenArray[*tokenBufIdx] = LITERAL_TRUE;
     (*tokenBufIdx)++;
+    tokenEnd = position;
     return 1;
   }
   fprintf(stderr, "expected 'true' literal. Was malformed.\n");
@@ -395,12 +728,13 @@ static char lexify_true(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
  */
 static char lexify_false(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
   int ch = 0;
-  if ((ch = fgetc(f)) == 'a' &&
-      (ch = fgetc(f)) == 'l' &&
-      (ch = fgetc(f)) == 's' &&
-      (ch = fgetc(f)) == 'e') {
+  if ((ch = next_char(f)) == 'a' &&
+      (ch = next_char(f)) == 'l' &&
+      (ch = next_char(f)) == 's' &&
+      (ch = next_char(f)) == 'e') {
     tokenArray[*tokenBufIdx] = LITERAL_FALSE;
     (*tokenBufIdx)++;
+    tokenEnd = position;
     return 1;
   }
   fprintf(stderr, "expected 'false' literal. Was malformed.\n");
@@ -413,17 +747,129 @@ static char lexify_false(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
  */
 static char lexify_null(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
   int ch = 0;
-  if ((ch = fgetc(f)) == 'u' &&
-      (ch = fgetc(f)) == 'l' &&
-      (ch = fgetc(f)) == 'l') {
+  if ((ch = next_char(f)) == 'u' &&
+      (ch = next_char(f)) == 'l' &&
+      (ch = next_char(f)) == 'l') {
     tokenArray[*tokenBufIdx] = LITERAL_NULL;
     (*tokenBufIdx)++;
+    tokenEnd = position;
     return 1;
   }
   fprintf(stderr, "expected 'null' literal. Was malformed.\n");
   return 0;
 }
 
+/**
+ * `fgetc` that keeps `position` in sync with the bytes consumed from `f`,
+ * or from `input` when lexing a buffer.
+ */
+static inline int next_char(FILE* f) {
+  if (input) return position < inputLen ? (unsigned char)input[position++] : EOF;
+  int ch = fgetc(f);
+  if (ch != EOF) position++;
+  return ch;
+}
+
+/**
+ * `ungetc` counterpart of `next_char`.
+ */
+static inline void unread_char(int ch, FILE* f) {
+  if (!input) ungetc(ch, f);
+  position--;
+}
+
+/**
+ * Appends `ch` to `sb`, growing it geometrically.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static inline char append_char(StringBuffer* sb, int ch) {
+  if (sb->len == sb->capacity) {
+    size_t newCapacity = sb->capacity ? sb->capacity * 2 : INITIAL_STRING_BYTES;
+    char* temp = (char*)JsonRealloc(sb->allocator, sb->data, newCapacity);
+    if (!temp) {
+      fprintf(stderr, "lexify_string: failed to realloc string buffer!\n");
+      return -1;
+    }
+    sb->data = temp;
+    sb->capacity = newCapacity;
+  }
+  sb->data[sb->len++] = (char)ch;
+  return 0;
+}
+
+/**
+ * Interns the member name `name` and appends its id to the window's
+ * `keyIds`, reallocating it when full.
+ * `escaped` names are decoded first, so `"id"` and `"i\u0064"` are the same key.
+ * Inside a tracked object the key is first compared with the one its shape
+ * predicts, then the object moves on to its next shape, which proves the key
+ * unique (`KEY_UNIQUE`) so the parser does not check it again. A key that repeats
+ * or no longer fits a shape is preceded by the shape it left (`KEY_LEFT_SHAPE`),
+ * whose keys the parser then checks it and the rest of the object against.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char record_key(Lexer* lx, char* name, size_t len, char escaped) {
+  ShapeTracker* tracker = &lx->tracker;
+  uint32_t** keyIds = &lx->window.keyIds;
+  size_t* keyCount = &lx->window.keyCount;
+  if (*keyCount + 2 > lx->keyCapacity) {
+    size_t newCapacity = lx->keyCapacity ? lx->keyCapacity * 2 : INITIAL_MAX_KEYS;
+    uint32_t* temp = (uint32_t*)JsonRealloc(lx->allocator, *keyIds, newCapacity * sizeof(uint32_t));
+    if (!temp) {
+      fprintf(stderr, "tokenize: failed to realloc key id array!\n");
+      return -1;
+    }
+    *keyIds = temp;
+    lx->keyCapacity = newCapacity;
+  }
+
+  size_t d = tracker->depth;
+  char tracked = d > 0 && d <= MAX_SHAPE_DEPTH && tracker->objects[d];
+  uint32_t shape = tracked ? tracker->shapes[d] : SHAPE_NONE;
+
+  // escapes always shrink, so the terminator `UnescapeInPlace` writes stays inside the name's buffer
+  if (escaped) len = UnescapeInPlace(name, len);
+
+  uint32_t id = InternKeyInShape(shape, name, len);
+  if (id == INTERN_FAILED) return -1;
+  if (id > KEY_ID_MASK) {
+    fprintf(stderr, "tokenize: too many distinct member names!\n");
+    return -1;
+  }
+
+  uint32_t entry = id;
+  if (tracked) {
+    tracker->lastKeys[d] = id;
+    uint32_t next = ShapeAfter(shape, id);
+    if (next < SHAPE_REPEATED) {
+      entry |= KEY_UNIQUE;
+    } else if (shape != SHAPE_NONE) {
+      (*keyIds)[(*keyCount)++] = KEY_LEFT_SHAPE | shape;
+    }
+    tracker->shapes[d] = next < SHAPE_REPEATED ? next : SHAPE_NONE;
+  }
+
+  (*keyIds)[(*keyCount)++] = entry;
+  return 0;
+}
+
+/**
+ * Opens an array or object one level below the current one.
+ * Objects start at the root shape of the member name they sit under,
+ * and containers in arrays inherit the array's.
+ */
+static void enter_container(ShapeTracker* tracker, char isObject) {
+  size_t d = ++tracker->depth;
+  if (d > MAX_SHAPE_DEPTH) return;
+
+  tracker->pathKeys[d] = tracker->objects[d - 1] ? tracker->lastKeys[d - 1] : tracker->pathKeys[d - 1];
+  tracker->objects[d] = isObject;
+  tracker->lastKeys[d] = SHAPE_NONE;
+  tracker->shapes[d] = isObject ? ShapeRoot(tracker->pathKeys[d]) : SHAPE_NONE;
+}
+
 /**
  * Peeks at next character in `file`.
  * Always `unget`s the char, except when `EOF` is found.
@@ -431,13 +877,13 @@ static char lexify_null(FILE* f, TOKEN* tokenArray, size_t* tokenBufIdx) {
  * @returns integer representing the read character
  */
 int peek_next_char(FILE* file) {
-  int ch = fgetc(file);
+  int ch = next_char(file);
 
   if (ch == EOF) {
     return EOF;
   }
 
-  ungetc(ch, file);  // put char back
+  unread_char(ch, file);  // put char back
   return ch;
 }
 
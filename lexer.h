@@ -2,8 +2,21 @@
 #define LEXER_H
 #include <stdio.h>
 
+#include "options.h"
 #include "token.h"
 
+/**
+ * Opaque state of a lexer handing out its tokens a window at a time
+ */
+typedef struct Lexer Lexer;
+
 TokenStream* Tokenize(FILE* file);
+TokenStream* TokenizeWithOptions(FILE* file, const JsonOptions* opts);
+Lexer* OpenLexer(FILE* file, const JsonOptions* opts, size_t windowTokens);
+Lexer* OpenBufferLexer(char* buf, size_t len, const JsonOptions* opts, size_t windowTokens);
+TokenStream* LexNextTokens(Lexer* lexer);
+void CloseLexer(Lexer* lexer);
+size_t TokenizeErrorOffset(void);
+size_t TokenizedBytes(void);
 
 #endif
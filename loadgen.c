@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "build_config.h"
+#include "server.h"
+
+#define DEFAULT_CONNECTIONS 4     // concurrent clients unless `-c` says otherwise
+#define DEFAULT_REQUESTS 10000    // requests each client sends unless `-n` says otherwise
+
+/**
+ * One client: sends `requests` copies of the payload back to back over its own
+ * connection and records how long each took to be answered.
+ */
+typedef struct {
+  const char* socketPath;
+  const char* payload;
+  uint32_t len;
+  size_t requests;
+  double* latencies;  // seconds, one per request
+  size_t invalid;
+  char failed;
+} Client;
+
+static void* run_client(void* arg);
+static int compare_doubles(const void* a, const void* b);
+static double now_seconds(void);
+
+/**
+ * Load generator for `json_parser --serve`: hammers the server with one payload
+ * from many connections and reports throughput and latency percentiles.
+ */
+int main(int argc, char** argv) {
+  const char* socketPath = NULL;
+  const char* payloadPath = NULL;
+  size_t connections = DEFAULT_CONNECTIONS;
+  size_t requests = DEFAULT_REQUESTS;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      connections = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      requests = strtoul(argv[++i], NULL, 10);
+    } else if (!socketPath) {
+      socketPath = argv[i];
+    } else {
+      payloadPath = argv[i];
+    }
+  }
+
+  if (!socketPath || !payloadPath || connections == 0 || requests == 0) {
+    fprintf(stderr, RED "usage: ./json_parser_loadgen [-c connections] [-n requests per connection] <socket> <payload.json>\n" RESET_COLOR);
+    return -1;
+  }
+
+  int res = -1;
+  char* payload = NULL;
+  Client* clients = NULL;
+  pthread_t* threads = NULL;
+  double* latencies = NULL;
+  size_t started = 0;
+
+  FILE* fp = fopen(payloadPath, "r");
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open payload %s\n" RESET_COLOR, payloadPath);
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  rewind(fp);
+  payload = (char*)malloc(size > 0 ? size : 1);
+  if (!payload || size > MAX_PAYLOAD_SIZE || fread(payload, 1, size, fp) != (size_t)size) {
+    fprintf(stderr, RED "Failed to read payload %s\n" RESET_COLOR, payloadPath);
+    fclose(fp);
+    goto on_cleanup;
+  }
+  fclose(fp);
+
+  clients = (Client*)calloc(connections, sizeof(Client));
+  threads = (pthread_t*)malloc(connections * sizeof(pthread_t));
+  latencies = (double*)malloc(connections * requests * sizeof(double));
+  if (!clients || !threads || !latencies) {
+    fprintf(stderr, RED "Failed to allocate %zu clients\n" RESET_COLOR, connections);
+    goto on_cleanup;
+  }
+
+  double start = now_seconds();
+  for (; started < connections; started++) {
+    Client* c = &clients[started];
+    c->socketPath = socketPath;
+    c->payload = payload;
+    c->len = (uint32_t)size;
+    c->requests = requests;
+    c->latencies = latencies + started * requests;
+    if (pthread_create(&threads[started], NULL, run_client, c) != 0) {
+      fprintf(stderr, RED "Failed to start client %zu\n" RESET_COLOR, started);
+      break;
+    }
+  }
+
+  char failed = started < connections;
+  size_t invalid = 0;
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    failed |= clients[i].failed;
+    invalid += clients[i].invalid;
+  }
+  double elapsed = now_seconds() - start;
+  if (failed) {
+    fprintf(stderr, RED "Some clients failed to talk to %s\n" RESET_COLOR, socketPath);
+    goto on_cleanup;
+  }
+
+  size_t total = connections * requests;
+  qsort(latencies, total, sizeof(double), compare_doubles);
+  printf("%zu requests of %ld bytes over %zu connections in %.3fs (%zu invalid)\n", total, size, connections, elapsed, invalid);
+  printf("throughput: %.0f requests/s, %.1f MB/s\n", total / elapsed, total * (double)size / 1e6 / elapsed);
+  printf("latency: p50 %.1fus, p99 %.1fus, max %.1fus\n", latencies[total / 2] * 1e6, latencies[total * 99 / 100] * 1e6,
+         latencies[total - 1] * 1e6);
+  res = 0;
+
+on_cleanup:
+  free(payload);
+  free(clients);
+  free(threads);
+  free(latencies);
+  return res;
+}
+
+static void* run_client(void* arg) {
+  Client* c = (Client*)arg;
+
+  int fd = ConnectToServer(c->socketPath);
+  if (fd == -1) {
+    c->failed = 1;
+    return NULL;
+  }
+
+  for (size_t i = 0; i < c->requests; i++) {
+    Reply reply;
+    double start = now_seconds();
+    if (RequestValidation(fd, c->payload, c->len, &reply) == -1) {
+      c->failed = 1;
+      break;
+    }
+    c->latencies[i] = now_seconds() - start;
+    if (reply.status != REPLY_VALID) c->invalid++;
+  }
+
+  close(fd);
+  return NULL;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double now_seconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
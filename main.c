@@ -1,34 +1,466 @@
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "batch.h"
 #include "build_config.h"
+#include "decompress.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
+#include "perfcounters.h"
+#include "project.h"
+#include "server.h"
+#include "sidecar.h"
+
+#define INDEX_SUFFIX ".jidx"  // sidecar index of `file.json` lives in `file.json.jidx`
+#define MAX_PROJECTED_COLUMNS 64  // fields a single `--project` can select
+#define PROJECT_ROW_GROUP 4096    // rows `--project` buffers per column before printing them
+
+static int validate_single(const char* jsonFilePath, const JsonOptions* opts, char printStats, char profile, char* isValid);
+static int index_single(const char* jsonFilePath, char writeIndex, size_t shardCount);
+static int validate_many(const PathList* list, size_t workers, const JsonOptions* opts);
+static int project_single(const char* ndjsonPath, char* fields, const JsonOptions* opts);
+static size_t parse_column_specs(char* fields, ColumnSpec* specs);
+static int print_rows(const Column* columns, size_t columnCount, size_t rows, void* ctx);
+static void print_tsv_string(const char* text, size_t length);
+static void print_shape_stats(const ShapeStats* stats);
+static void print_phase(const char* phase, const CounterSample* sample, size_t inputBytes);
+static int serve(const char* socketPath, size_t workers, const JsonOptions* opts);
+static void request_stop(int signum);
+static void print_usage(void);
+
+static atomic_int stopServing = 0;  // set by SIGINT/SIGTERM while serving
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, RED "usage: ./json_parser <filename.json>\n" RESET_COLOR);
-    return -1;
+  JsonOptions opts = {0};
+  PathList list = {0};
+  size_t workers = 0;
+  char readStdin = 0;
+  char sawDirectory = 0;
+  char writeIndex = 0;
+  size_t shardCount = 0;
+  const char* socketPath = NULL;
+  char* projectedFields = NULL;
+  char printStats = 0;
+  char profile = 0;
+  int res = -1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--unique-keys") == 0) {
+      opts.rejectDuplicateKeys = 1;
+    } else if (strcmp(argv[i], "--stdin") == 0) {
+      readStdin = 1;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      workers = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--index") == 0) {
+      writeIndex = 1;
+    } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      shardCount = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      printStats = 1;
+    } else if (strcmp(argv[i], "--perf") == 0) {
+      profile = 1;
+    } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+      socketPath = argv[++i];
+    } else if (strcmp(argv[i], "--project") == 0 && i + 1 < argc) {
+      projectedFields = argv[++i];
+    } else if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+      opts.memoryLimit = strtoull(argv[++i], NULL, 10);
+    } else {
+      struct stat st;
+      char isDirectory = stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode);
+      char status = isDirectory ? AddDirectory(&list, argv[i]) : AddPath(&list, argv[i]);
+      if (status == -1) goto on_cleanup;
+      sawDirectory |= isDirectory;
+    }
+  }
+
+  if (socketPath) {
+    if (workers == 0) workers = sysconf(_SC_NPROCESSORS_ONLN);
+    res = serve(socketPath, workers, &opts);
+    goto on_cleanup;
+  }
+
+  if (readStdin && AddPathsFromStream(&list, stdin) == -1) goto on_cleanup;
+
+  if (list.count == 0 || (projectedFields && (list.count != 1 || readStdin || sawDirectory))) {
+    print_usage();
+    goto on_cleanup;
+  }
+
+  if (projectedFields) {
+    res = project_single(list.paths[0], projectedFields, &opts);
+    goto on_cleanup;
   }
-  const char* jsonFilePath = argv[1];
 
-  FILE* fp = fopen(jsonFilePath, "r");
+  if (list.count == 1 && !readStdin && !sawDirectory) {
+    char isValid = 0;
+    res = validate_single(list.paths[0], &opts, printStats, profile, &isValid);
+    if (res == 0 && isValid && (writeIndex || shardCount)) {
+      res = index_single(list.paths[0], writeIndex, shardCount);
+    }
+  } else {
+    if (workers == 0) workers = sysconf(_SC_NPROCESSORS_ONLN);
+    res = validate_many(&list, workers, &opts);
+  }
+
+on_cleanup:
+  FreePathList(&list);
+  return res;
+}
+
+static int validate_single(const char* jsonFilePath, const JsonOptions* opts, char printStats, char profile, char* isValid) {
+  PerfCounters counters;
+  CounterSample phases[2];
+  // opened first, so they also count the thread decompressing the input while it is tokenized
+  if (profile) OpenPerfCounters(&counters);  // without counters the phases are still timed
+
+  FILE* fp = OpenJsonInput(jsonFilePath);
   if (!fp) {
     fprintf(stderr, RED "Failed to open JSON file %s\n" RESET_COLOR, jsonFilePath);
+    if (profile) ClosePerfCounters(&counters);
     return -1;
   }
 
-  TokenStream* ts = Tokenize(fp);
+  if (profile) StartPerfCounters(&counters);
+  TokenStream* ts = TokenizeWithOptions(fp, opts);
+  size_t inputBytes = TokenizedBytes();
+  if (profile) {
+    StopPerfCounters(&counters, &phases[0]);
+    StartPerfCounters(&counters);
+  }
   int parsingResult = Parse(ts);
+  if (profile) {
+    StopPerfCounters(&counters, &phases[1]);
+    ClosePerfCounters(&counters);
+  }
+  ShapeStats stats;
+  GetShapeStats(&stats);
+  FreeInternTable();
+
+  // corrupt compressed input surfaces as a read error rather than as a lexing error
+  if (ferror(fp)) {
+    fprintf(stderr, RED "Failed to read JSON file %s\n" RESET_COLOR, jsonFilePath);
+    fclose(fp);
+    return -1;
+  }
 
+  *isValid = parsingResult == 0;
   if (parsingResult == 0) {
     printf(GREEN "%s is valid JSON.\n" RESET_COLOR, jsonFilePath);
   } else if (parsingResult == -1) {
     printf(RED "%s is NOT valid JSON.\n" RESET_COLOR, jsonFilePath);
   } else {
     fprintf(stderr, RED "Unknown error. json_parser returned status code %d\n" RESET_COLOR, parsingResult);
+    fclose(fp);
     return -1;
   }
 
+  if (printStats) print_shape_stats(&stats);
+  if (profile) {
+    print_phase("tokenize", &phases[0], inputBytes);
+    print_phase("parse", &phases[1], inputBytes);
+  }
   fclose(fp);
   return 0;
 }
+
+/**
+ * Validates every path of `list` on a pool of `workers` threads,
+ * then lists the failures followed by a one line summary.
+ *
+ * @returns 0 if every file could be read, -1 otherwise
+ */
+static int validate_many(const PathList* list, size_t workers, const JsonOptions* opts) {
+  BatchSummary summary;
+  unsigned char* statuses = ValidateBatch(list, workers, opts, &summary);
+  if (!statuses) {
+    fprintf(stderr, RED "Failed to validate batch of %zu files\n" RESET_COLOR, list->count);
+    return -1;
+  }
+
+  for (size_t i = 0; i < list->count; i++) {
+    if (statuses[i] == FILE_INVALID) {
+      printf(RED "invalid: %s\n" RESET_COLOR, list->paths[i]);
+    } else if (statuses[i] == FILE_UNREADABLE) {
+      printf(RED "unreadable: %s\n" RESET_COLOR, list->paths[i]);
+    }
+  }
+
+  printf("%s%zu files: %zu valid, %zu invalid, %zu unreadable in %.3fs on %zu workers\n" RESET_COLOR,
+         summary.invalid || summary.unreadable ? RED : GREEN,
+         list->count, summary.valid, summary.invalid, summary.unreadable, summary.seconds, summary.workers);
+
+  free(statuses);
+  return summary.unreadable ? -1 : 0;
+}
+
+/**
+ * Prints the `fields` (see `parse_column_specs`) of every valid record of the
+ * NDJSON file at `ndjsonPath` as tab separated values, one row per record under
+ * a header of the field paths, then reports on stderr how many records were
+ * projected and how many were skipped as invalid.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int project_single(const char* ndjsonPath, char* fields, const JsonOptions* opts) {
+  ColumnSpec specs[MAX_PROJECTED_COLUMNS];
+  size_t count = parse_column_specs(fields, specs);
+  if (count == 0) {
+    print_usage();
+    return -1;
+  }
+
+  FILE* fp = OpenJsonInput(ndjsonPath);
+  if (!fp) {
+    fprintf(stderr, RED "Failed to open NDJSON file %s\n" RESET_COLOR, ndjsonPath);
+    return -1;
+  }
+
+  Projection* p = CreateProjection(specs, count, PROJECT_ROW_GROUP, opts, print_rows, NULL);
+  if (!p) {
+    fclose(fp);
+    return -1;
+  }
+
+  for (size_t i = 0; i < count; i++) printf("%s%s", i ? "\t" : "", specs[i].path);
+  printf("\n");
+
+  int res = ProjectNdjson(p, fp);
+  if (res == 0 && ferror(fp)) {
+    fprintf(stderr, RED "Failed to read NDJSON file %s\n" RESET_COLOR, ndjsonPath);
+    res = -1;
+  }
+  if (res == 0) {
+    fprintf(stderr, GREEN "%zu records projected, %zu invalid records skipped\n" RESET_COLOR, ProjectedRows(p), InvalidRecords(p));
+  }
+
+  FreeProjection(p);
+  FreeInternTable();
+  fclose(fp);
+  return res;
+}
+
+/**
+ * Splits the comma separated `fields` in place into `specs`. Each field is a dotted
+ * path through nested objects (`user.name`), optionally followed by `:int`,
+ * `:double` or `:string`, the default.
+ *
+ * @returns how many fields were parsed, 0 if one of them is malformed or there are too many
+ */
+static size_t parse_column_specs(char* fields, ColumnSpec* specs) {
+  size_t count = 0;
+  char* saveptr = NULL;
+
+  for (char* field = strtok_r(fields, ",", &saveptr); field; field = strtok_r(NULL, ",", &saveptr)) {
+    if (count == MAX_PROJECTED_COLUMNS) {
+      fprintf(stderr, RED "--project selects at most %d fields\n" RESET_COLOR, MAX_PROJECTED_COLUMNS);
+      return 0;
+    }
+
+    ColumnSpec* spec = &specs[count++];
+    spec->path = field;
+    spec->type = COLUMN_STRING;
+
+    char* type = strchr(field, ':');
+    if (!type) continue;
+    *type++ = '\0';
+    if (strcmp(type, "int") == 0) {
+      spec->type = COLUMN_INT64;
+    } else if (strcmp(type, "double") == 0) {
+      spec->type = COLUMN_DOUBLE;
+    } else if (strcmp(type, "string") != 0) {
+      fprintf(stderr, RED "Unknown type %s for field %s\n" RESET_COLOR, type, field);
+      return 0;
+    }
+  }
+  return count;
+}
+
+/**
+ * `RowGroupCallback` printing each row as tab separated values, with `\\N` for nulls.
+ */
+static int print_rows(const Column* columns, size_t columnCount, size_t rows, void* ctx) {
+  (void)ctx;
+
+  for (size_t row = 0; row < rows; row++) {
+    for (size_t i = 0; i < columnCount; i++) {
+      const Column* c = &columns[i];
+      if (i > 0) putchar('\t');
+
+      if (!(c->validity[row / 8] & (1u << (row % 8)))) {
+        fputs("\\N", stdout);
+      } else if (c->spec.type == COLUMN_INT64) {
+        printf("%" PRId64, c->ints[row]);
+      } else if (c->spec.type == COLUMN_DOUBLE) {
+        printf("%.17g", c->doubles[row]);
+      } else {
+        uint32_t begin = c->stringOffsets[row];
+        print_tsv_string(c->stringData + begin, c->stringOffsets[row + 1] - begin);
+      }
+    }
+    putchar('\n');
+  }
+  return ferror(stdout) ? -1 : 0;
+}
+
+/**
+ * Prints `text` with backslashes, tabs, newlines and carriage returns escaped,
+ * so every row stays on one line and no string reads as the `\\N` of a null.
+ */
+static void print_tsv_string(const char* text, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    switch (text[i]) {
+      case '\\':
+        fputs("\\\\", stdout);
+        break;
+      case '\t':
+        fputs("\\t", stdout);
+        break;
+      case '\n':
+        fputs("\\n", stdout);
+        break;
+      case '\r':
+        fputs("\\r", stdout);
+        break;
+      default:
+        putchar(text[i]);
+        break;
+    }
+  }
+}
+
+/**
+ * Writes the sidecar index of the (valid) file at `jsonFilePath` if asked to
+ * or if the existing one is missing or stale, then prints `shardCount`
+ * element aligned byte ranges of it.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static int index_single(const char* jsonFilePath, char writeIndex, size_t shardCount) {
+  size_t pathLen = strlen(jsonFilePath);
+  char* indexPath = (char*)malloc(pathLen + sizeof(INDEX_SUFFIX));
+  if (!indexPath) {
+    fprintf(stderr, RED "Failed to malloc index path\n" RESET_COLOR);
+    return -1;
+  }
+  memcpy(indexPath, jsonFilePath, pathLen);
+  memcpy(indexPath + pathLen, INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+
+  int res = -1;
+  Shard* shards = NULL;
+  SidecarIndex* idx = writeIndex ? NULL : OpenSidecarIndex(jsonFilePath, indexPath, NULL);
+  if (!idx) {
+    if (WriteSidecarIndex(jsonFilePath, indexPath, NULL) == -1) {
+      fprintf(stderr, RED "Failed to write index %s\n" RESET_COLOR, indexPath);
+      goto on_cleanup;
+    }
+    idx = OpenSidecarIndex(jsonFilePath, indexPath, NULL);
+    if (!idx) goto on_cleanup;
+    printf("Wrote index %s (%" PRIu64 " elements)\n", indexPath, SidecarElementCount(idx));
+  }
+
+  if (shardCount) {
+    shards = (Shard*)malloc(shardCount * sizeof(Shard));
+    if (!shards) {
+      fprintf(stderr, RED "Failed to malloc %zu shards\n" RESET_COLOR, shardCount);
+      goto on_cleanup;
+    }
+
+    size_t n = SidecarShards(idx, shardCount, shards);
+    for (size_t i = 0; i < n; i++) {
+      printf("shard %zu: bytes [%" PRIu64 ", %" PRIu64 "), elements [%" PRIu64 ", %" PRIu64 ")\n",
+             i, shards[i].begin, shards[i].end, shards[i].firstElement, shards[i].firstElement + shards[i].elementCount);
+    }
+  }
+  res = 0;
+
+on_cleanup:
+  CloseSidecarIndex(idx);
+  free(shards);
+  free(indexPath);
+  return res;
+}
+
+/**
+ * Prints how often object shapes predicted the next member name (only tracked with `--unique-keys`).
+ */
+static void print_shape_stats(const ShapeStats* stats) {
+  if (stats->keys == 0) {
+    printf("shape cache: no member names checked\n");
+    return;
+  }
+
+  printf("shape cache: %.1f%% of %zu transitions cached, %.1f%% of %zu keys predicted\n",
+         100.0 * stats->cachedTransitions / (stats->transitions ? stats->transitions : 1), stats->transitions,
+         100.0 * stats->predictedKeys / stats->keys, stats->keys);
+}
+
+/**
+ * Prints how long `phase` took over `inputBytes` of JSON, its IPC and its misses per KB
+ * of input, or `n/a` for whatever the counters could not measure.
+ */
+static void print_phase(const char* phase, const CounterSample* sample, size_t inputBytes) {
+  double kb = inputBytes / 1024.0;
+  printf("%-8s %9.3f ms %9.1f MB/s", phase, sample->seconds * 1e3, inputBytes / 1e6 / sample->seconds);
+
+  if (sample->available[COUNTER_CYCLES] && sample->available[COUNTER_INSTRUCTIONS] && sample->values[COUNTER_CYCLES] > 0) {
+    printf("  IPC %.2f", (double)sample->values[COUNTER_INSTRUCTIONS] / sample->values[COUNTER_CYCLES]);
+  } else {
+    printf("  IPC n/a");
+  }
+
+  for (CounterKind kind = COUNTER_BRANCH_MISSES; kind < COUNTER_KINDS; kind++) {
+    if (sample->available[kind] && kb > 0) {
+      printf("  %s %.2f/KB", CounterName(kind), sample->values[kind] / kb);
+    } else {
+      printf("  %s n/a", CounterName(kind));
+    }
+  }
+  printf("\n");
+}
+
+/**
+ * Runs the validation server on `socketPath` until interrupted.
+ *
+ * @returns 0 after a clean shutdown, -1 otherwise
+ */
+static int serve(const char* socketPath, size_t workers, const JsonOptions* opts) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  printf(GREEN "Listening on %s with %zu workers\n" RESET_COLOR, socketPath, workers);
+  fflush(stdout);
+  return ServeValidation(socketPath, workers, opts, &stopServing);
+}
+
+static void request_stop(int signum) {
+  (void)signum;
+  atomic_store(&stopServing, 1);
+}
+
+static void print_usage(void) {
+  fprintf(stderr, RED "usage: ./json_parser [--unique-keys] [--max-memory BYTES] [-j workers] [--stdin] <file.json | directory>...\n" RESET_COLOR);
+  fprintf(stderr, RED "       ./json_parser [--unique-keys] [--max-memory BYTES] [--stats] [--perf] [--index] [--shards K] <file.json>\n" RESET_COLOR);
+  fprintf(stderr, RED "       ./json_parser [--unique-keys] [--max-memory BYTES] [-j workers] --serve <socket>\n" RESET_COLOR);
+  fprintf(stderr, RED "       ./json_parser [--unique-keys] [--max-memory BYTES] --project <path[:type],...> <file.ndjson>\n" RESET_COLOR);
+  fprintf(stderr, RED "  directories are searched recursively for .json, .json.gz and .json.zst files,\n" RESET_COLOR);
+  fprintf(stderr, RED "  --stdin reads one path per line\n" RESET_COLOR);
+  fprintf(stderr, RED "  --index writes a sidecar index of a root array to <file.json>" INDEX_SUFFIX ",\n" RESET_COLOR);
+  fprintf(stderr, RED "  --shards K splits it into K byte ranges aligned to its elements\n" RESET_COLOR);
+  fprintf(stderr, RED "  --stats reports the shape cache hit rate of --unique-keys\n" RESET_COLOR);
+  fprintf(stderr, RED "  --perf reports hardware counters of the tokenize and parse phases\n" RESET_COLOR);
+  fprintf(stderr, RED "  --max-memory fails documents that need more than BYTES to validate\n" RESET_COLOR);
+  fprintf(stderr, RED "  --serve validates length-prefixed payloads sent to a Unix socket until interrupted\n" RESET_COLOR);
+  fprintf(stderr, RED "  --project prints dotted paths (user.name) of every valid NDJSON record as tab separated\n" RESET_COLOR);
+  fprintf(stderr, RED "  values, typed int, double or string (the default); missing or mistyped values print \\N\n" RESET_COLOR);
+}
@@ -0,0 +1,23 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+#include <stddef.h>
+
+#include "allocator.h"
+
+/**
+ * Optional checks and behaviours on top of plain RFC 8259 validation.
+ * Zero-initialize it (`JsonOptions opts = {0};`) to get the default behaviour.
+ * Fields:
+ * - `rejectDuplicateKeys` fail objects whose member names repeat (compared after decoding escapes, lone surrogates all decoding to U+FFFD)
+ * - `recordSpans` keep the byte range of every token, needed by `ParseWithHandler`
+ * - `allocator` where the token stream and parser state are allocated, `NULL` for the C library
+ * - `memoryLimit` bytes a single document may allocate before validation fails, 0 for no limit
+ */
+typedef struct {
+  char rejectDuplicateKeys;
+  char recordSpans;
+  const JsonAllocator* allocator;
+  size_t memoryLimit;
+} JsonOptions;
+
+#endif
@@ -2,66 +2,184 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "lexer.h"
 
 #define MAX_DEPTH 19  // acceptable number of nested arrays and objects
+#define INITIAL_KEY_SLOTS 16  // power of two, member names an object holds before its key set grows
+#define STREAM_WINDOW_TOKENS 4096  // tokens `ParseStream` lexes at a time
+#define NO_TOKEN ((TOKEN)0)  // what `peek` returns past the last token
+
+/**
+ * Small open addressing set of the member names seen in the object currently
+ * being parsed at one nesting level. It is reused by every object at that level:
+ * bumping `generation` empties it without touching its memory.
+ */
+typedef struct {
+  uint32_t* slots;   // interned key ids
+  uint32_t* stamps;  // a slot is occupied only if its stamp equals `generation`
+  size_t capacity;   // power of two
+  size_t count;
+  uint32_t generation;
+} KeySet;
 
 static inline char is_simple_value(TOKEN tk);
-static char eat(TOKEN expectedToken, TOKEN* ta);
-static char parse_value(TOKEN* tokenArray);
-static char parse_object(TOKEN* ta);
-static char parse_array(TOKEN* ta);
+static inline TOKEN peek(void);
+static TOKEN next_window(void);
+static char eat(TOKEN expectedToken);
+static char parse_root(void);
+static char parse_value(void);
+static char parse_object(void);
+static char parse_array(void);
+static void finish_parse(void);
 static void free_token_stream(TokenStream* ts);
+static void begin_key_set(KeySet* set);
+static char insert_key(KeySet* set, uint32_t id);
+static inline uint32_t next_key_id(void);
+static KeySet* leave_shape(uint32_t shape);
+static void report_duplicate(uint32_t id);
+static char grow_key_set(KeySet* set);
+static void free_key_sets(void);
+static inline SaxEventType scalar_event(TOKEN tk);
+static inline char emit(SaxEventType type, size_t tokenIdx);
+static char flush_events(void);
+static size_t stopped_at(void);
+
+// Parser state is per thread so independent documents can be validated concurrently
+static _Thread_local const TOKEN* tokens = NULL;  // the stream's, or the current window of `lexer`
+static _Thread_local size_t tokenCount = 0;
+static _Thread_local size_t cursor = 0;  // tracks position in `tokens`
+static _Thread_local Lexer* lexer = NULL;  // only set by `ParseStream`, refills `tokens` once consumed
+static _Thread_local char lexFailed = 0;
+static _Thread_local size_t consumedEnd = 0;  // just past the last token of the previous windows
+static _Thread_local size_t depth = 0;   // tracks how deep the parser is in the call stack due to its parsing static funcs
+
+static _Thread_local char uniqueKeys = 0;  // whether duplicate member names are rejected
+static _Thread_local const uint32_t* keyIds = NULL;  // member names of `tokens`, in order
+static _Thread_local size_t keyCount = 0;
+static _Thread_local size_t keyCursor = 0;  // tracks position in `keyIds`
+static _Thread_local KeySet keySets[MAX_DEPTH + 2];  // one per nesting level `parse_object` can be called at
+static _Thread_local const JsonAllocator* allocator = NULL;  // the stream's, key sets are allocated with it too
 
-static size_t cursor = 0;  // tracks position in the `TOKEN*` array
-static size_t depth = 0;   // tracks how deep the parser is in the call stack due to its parsing static funcs
+static _Thread_local const SaxHandler* saxHandler = NULL;  // only set by `ParseWithHandler`
+static _Thread_local const Span* spans = NULL;
+static _Thread_local SaxEvent saxEvents[SAX_BATCH_SIZE];  // events not yet handed to `saxHandler`
+static _Thread_local size_t saxCount = 0;
+static _Thread_local size_t errorOffset = 0;  // where the last failed parse stopped, see `ParseErrorOffset`
 
 /**
  * Parses and validates a JSON file described by the
  * token stream `ts` using recursive descent.
  *
+ * If `ts` carries `keyIds` (see `TokenizeWithOptions`), objects
+ * whose member names repeat are rejected as well.
+ *
  * @returns 0 for valid JSONs, -1 otherwise
  */
 int Parse(TokenStream* ts) {
+  return ParseWithHandler(ts, NULL);
+}
+
+/**
+ * Same as `Parse`, but also reports every value, key and container boundary
+ * to `handler` (which may be `NULL`) as `SaxEvent`s, in batches of up to
+ * `SAX_BATCH_SIZE` so the callback's cost is paid once per batch instead of per token.
+ *
+ * Events are delivered while parsing, so a document that turns out to be invalid
+ * may already have reported some. The last partial batch is only delivered for valid ones.
+ * A handler requires `ts` to carry `spans` (see `JsonOptions.recordSpans`).
+ * As `ts` holds every token of the document, see `ParseStream` to lex it as events are delivered.
+ *
+ * @returns 0 for valid JSONs, -1 otherwise
+ */
+int ParseWithHandler(TokenStream* ts, const SaxHandler* handler) {
   // An empty file is not valid JSON
   if (!ts || !ts->tokenArray || ts->size == 0) {
     fprintf(stderr, "Parse: no tokens in JSON file!\n");
+    errorOffset = 0;
+    free_token_stream(ts);
     return -1;
   }
 
-  char res = 0;
-  TOKEN* ta = ts->tokenArray;
-
-  /**
-   * Although the RFC states that a valid JSON text is of type:
-   * `ws value ws`
-   *
-   * where `ws` is whitespace and value is a simple or complex JSON value,
-   *
-   * the test file `tests/step5/fail1.json` from json.org says
-   * "A JSON payload should be an object or array, not a string.",
-   * so I am outright rejecting edge cases like a JSON file
-   * that's a single boolean, string or 'null'
-   */
-  if (is_simple_value(ta[cursor]) && ts->size == 1) {
-    res = -1;
-    goto on_cleanup;
+  if (handler && !ts->spans) {
+    fprintf(stderr, "Parse: SAX events need a token stream with spans!\n");
+    errorOffset = 0;
+    free_token_stream(ts);
+    return -1;
   }
 
-  res = parse_value(ta);
-  if (res == -1) goto on_cleanup;
+  tokens = ts->tokenArray;
+  tokenCount = ts->size;
+  uniqueKeys = ts->keyIds != NULL;
+  keyIds = ts->keyIds;
+  keyCount = ts->keyCount;
+  allocator = ts->allocator;
+  saxHandler = handler;
+  spans = ts->spans;
 
-  if (cursor != ts->size) {
-    fprintf(stderr, "Parse: only a single root value allowed in JSON!\n");
-    res = -1;
+  char res = parse_root();
+  if (res == -1) errorOffset = stopped_at();
+  finish_parse();
+  free_token_stream(ts);
+  return res;
+}
+
+/**
+ * Same as `ParseWithHandler`, but lexes `file` itself with `opts` (which may be `NULL`),
+ * `STREAM_WINDOW_TOKENS` tokens at a time, so events reach `handler` while the rest of the
+ * input is still unread. Tokens, spans and member name ids only live as long as their window,
+ * so memory does not grow with the length of the document. Rejecting duplicate keys still
+ * keeps its distinct member names interned, and the keys of its widest object.
+ *
+ * @returns 0 for valid JSONs, -1 otherwise
+ */
+int ParseStream(FILE* file, const JsonOptions* opts, const SaxHandler* handler) {
+  JsonOptions withSpans = {0};
+  if (opts) withSpans = *opts;
+  if (handler) withSpans.recordSpans = 1;
+
+  return ParseLexer(OpenLexer(file, &withSpans, STREAM_WINDOW_TOKENS), &withSpans, handler);
+}
+
+/**
+ * Same as `ParseStream`, but consumes the windows of the already open `source`
+ * (see `OpenLexer` and `OpenBufferLexer`), opened with `opts`, and closes it.
+ * A `handler` needs `opts->recordSpans` set.
+ *
+ * @returns 0 for valid JSONs, -1 otherwise
+ */
+int ParseLexer(Lexer* source, const JsonOptions* opts, const SaxHandler* handler) {
+  if (!source || (handler && !(opts && opts->recordSpans))) {
+    if (source) fprintf(stderr, "Parse: SAX events need a lexer recording spans!\n");
+    CloseLexer(source);
+    errorOffset = 0;
+    return -1;
   }
+  lexer = source;
+  uniqueKeys = opts && opts->rejectDuplicateKeys;
+  saxHandler = handler;
 
-on_cleanup:
-  free_token_stream(ts);
-  depth = 0;
-  cursor = 0;
+  char res = parse_root();
+  if (res == -1) errorOffset = lexFailed ? TokenizeErrorOffset() : stopped_at();
+  finish_parse();  // before the lexer, whose budget the key sets were allocated from
+  CloseLexer(lexer);
+  lexer = NULL;
+  lexFailed = 0;
+  consumedEnd = 0;
   return res;
 }
 
+/**
+ * Byte offset of the token the last failed `Parse` on this thread stopped at,
+ * or just past the last token if it ran out of them. Only known when the
+ * token stream carried spans, 0 otherwise.
+ */
+size_t ParseErrorOffset(void) {
+  return errorOffset;
+}
+
 /**
  * Returns true if the token `tk` is a JSON value that can be represented in a single token i.e:
  *
@@ -72,8 +190,43 @@ static inline char is_simple_value(TOKEN tk) {
 }
 
 /**
- * Attempts to consume an `expectedToken`
- * in the currently parsed token array `ta`.
+ * The token at `cursor`, or `NO_TOKEN` once they ran out.
+ */
+static inline TOKEN peek(void) {
+  return cursor < tokenCount ? tokens[cursor] : next_window();
+}
+
+/**
+ * Moves on to the next window of `lexer` once every token of the current one
+ * was consumed. `keyIds` and `spans` follow it, so they only ever describe `tokens`.
+ *
+ * @returns the first token of the new window, `NO_TOKEN` at the end of the input or on lexing errors
+ */
+static TOKEN next_window(void) {
+  if (!lexer || lexFailed) return NO_TOKEN;
+  if (spans && tokenCount > 0) consumedEnd = spans[tokenCount - 1].offset + spans[tokenCount - 1].length;
+
+  TokenStream* window = LexNextTokens(lexer);
+  if (!window) {
+    lexFailed = 1;
+    tokenCount = 0;
+    cursor = 0;
+    return NO_TOKEN;
+  }
+
+  tokens = window->tokenArray;
+  tokenCount = window->size;
+  cursor = 0;
+  spans = window->spans;
+  keyIds = window->keyIds;
+  keyCount = window->keyCount;
+  keyCursor = 0;
+  allocator = window->allocator;
+  return tokenCount > 0 ? tokens[0] : NO_TOKEN;
+}
+
+/**
+ * Attempts to consume an `expectedToken` from `tokens`.
  *
  * This function uses the static variable `cursor` to track
  * the current token in the stream.
@@ -81,16 +234,60 @@ static inline char is_simple_value(TOKEN tk) {
  * Returns 0 on success, incrementing `cursor`
  * Returns -1 on failure
  */
-static char eat(TOKEN expectedToken, TOKEN* ta) {
-  if (ta[cursor] == expectedToken) {
+static char eat(TOKEN expectedToken) {
+  TOKEN currentToken = peek();
+  if (currentToken == expectedToken) {
     cursor++;
     return 0;
+  } else if (currentToken == NO_TOKEN) {
+    if (!lexFailed) fprintf(stderr, "eat: expected %c, got the end of the input\n", expectedToken);
+    return -1;
   } else {
-    fprintf(stderr, "eat: expected %c, got %c\n", expectedToken, ta[cursor]);
+    fprintf(stderr, "eat: expected %c, got %c\n", expectedToken, currentToken);
     return -1;
   }
 }
 
+/**
+ * Parses the single root value a JSON text must be made of.
+ *
+ * @returns 0 for valid JSONs, -1 otherwise
+ */
+static char parse_root(void) {
+  TOKEN root = peek();
+  // An empty file is not valid JSON
+  if (root == NO_TOKEN) {
+    if (!lexFailed) fprintf(stderr, "Parse: no tokens in JSON file!\n");
+    return -1;
+  }
+
+  /**
+   * Although the RFC states that a valid JSON text is of type:
+   * `ws value ws`
+   *
+   * where `ws` is whitespace and value is a simple or complex JSON value,
+   *
+   * the test file `tests/step5/fail1.json` from json.org says
+   * "A JSON payload should be an object or array, not a string.",
+   * so I am outright rejecting edge cases like a JSON file
+   * that's a single boolean, string or 'null'
+   */
+  if (is_simple_value(root)) return -1;
+
+  if (parse_value() == -1) return -1;
+
+  if (peek() != NO_TOKEN) {
+    fprintf(stderr, "Parse: only a single root value allowed in JSON!\n");
+    return -1;
+  }
+  if (lexFailed) return -1;  // the lexer gave up right after the root value
+
+  if (saxHandler && saxCount > 0) {
+    return flush_events();
+  }
+  return 0;
+}
+
 /**
  * Parses a JSON value:
  *
@@ -105,27 +302,29 @@ static char eat(TOKEN expectedToken, TOKEN* ta) {
  * At end of execution, decrements `depth` and
  * @returns 0 on success and -1 on failure
  */
-static char parse_value(TOKEN* tokenArray) {
+static char parse_value(void) {
   if (depth > MAX_DEPTH) {
     fprintf(stderr, "Nesting in JSON file exceeds safe limit (%d). Aborting!\n", MAX_DEPTH);
     return -1;
   }
 
   char res = 0;
-  TOKEN currentToken = tokenArray[cursor];
+  TOKEN currentToken = peek();
 
   if (is_simple_value(currentToken)) {
-    res = eat(currentToken, tokenArray);
+    if (saxHandler && emit(scalar_event(currentToken), cursor) == -1) return -1;
+    res = eat(currentToken);
   } else if (currentToken == BEGIN_OBJECT) {
     depth++;
-    res = parse_object(tokenArray);
+    res = parse_object();
     depth--;
   } else if (currentToken == BEGIN_ARRAY) {
     depth++;
-    res = parse_array(tokenArray);
+    res = parse_array();
     depth--;
   } else {
-    fprintf(stderr, "parse_value: unexpected token: %c\n", currentToken);
+    if (currentToken != NO_TOKEN) fprintf(stderr, "parse_value: unexpected token: %c\n", currentToken);
+    else if (!lexFailed) fprintf(stderr, "parse_value: unexpected end of the input\n");
     res = -1;
   }
 
@@ -142,49 +341,77 @@ static char parse_value(TOKEN* tokenArray) {
  * After consuming `{`, the `STRING` key, and `NAME_SEPARATOR`,
  * calls `parse_value` recursively for the last element of `Member`
  *
+ * When member names are tracked, the lexer already walked the shapes (see `ShapeRoot`)
+ * of the object's key sequence, and flagged the keys they proved unique (`KEY_UNIQUE`):
+ * objects laid out like the previous one at the same path are not checked again.
+ * Other keys are inserted into this nesting level's `KeySet`, seeded with the keys
+ * of the shape the object left (`KEY_LEFT_SHAPE`), if any
+ *
  * @returns 0 on success and -1 on failure
  */
-static char parse_object(TOKEN* ta) {
+static char parse_object(void) {
   if (depth > MAX_DEPTH) {
     fprintf(stderr, "Nesting in JSON file exceeds safe limit (%d). Aborting!\n", MAX_DEPTH);
     return -1;
   }
 
   char res = 0;
-  res = eat(BEGIN_OBJECT, ta);
+  res = eat(BEGIN_OBJECT);
   if (res == -1) return -1;
-  TOKEN currentToken = ta[cursor];
+  if (saxHandler && emit(SAX_START_OBJECT, cursor - 1) == -1) return -1;
+  TOKEN currentToken = peek();
+
+  KeySet* keySet = NULL;  // only needed once a key was not proven unique by the lexer
 
   while (currentToken != END_OBJECT) {
-    res = eat(STRING, ta);  // key
+    res = eat(STRING);  // key
     if (res == -1) return -1;
-    res = eat(NAME_SEPARATOR, ta);  // :
+    if (saxHandler && emit(SAX_KEY, cursor - 1) == -1) return -1;
+    res = eat(NAME_SEPARATOR);  // :
     if (res == -1) return -1;
-    res = parse_value(ta);  // JSON value
+    if (uniqueKeys) {
+      uint32_t id = next_key_id();
+      if (id != INTERN_FAILED && (id & KEY_LEFT_SHAPE)) {
+        keySet = leave_shape(id & KEY_ID_MASK);
+        if (!keySet) return -1;
+        id = next_key_id();
+      }
+      if (id == INTERN_FAILED) return -1;
+
+      if (!(id & KEY_UNIQUE)) {
+        if (!keySet) {
+          keySet = &keySets[depth];
+          begin_key_set(keySet);
+        }
+        if (insert_key(keySet, id) == -1) return -1;
+      }
+    }
+    res = parse_value();  // JSON value
     if (res == -1) return -1;
 
     // object is over
-    if (ta[cursor] == END_OBJECT) {
+    if (peek() == END_OBJECT) {
       break;
     }
 
     // object has more entries
-    if (ta[cursor] == VALUE_SEPARATOR) {
-      res = eat(VALUE_SEPARATOR, ta);
+    if (peek() == VALUE_SEPARATOR) {
+      res = eat(VALUE_SEPARATOR);
       if (res == -1) return -1;
 
       // if previous token is a comma and the object is already closed, this is invalid
       // a following member is expected in this case
-      if (ta[cursor] == END_OBJECT) {
+      if (peek() == END_OBJECT) {
         fprintf(stderr, "Trailing comma in object!\n");
         return -1;
       }
     }
-    currentToken = ta[cursor];
+    currentToken = peek();
   }
 
-  res = eat(END_OBJECT, ta);
+  res = eat(END_OBJECT);
   if (res == -1) return -1;
+  if (saxHandler && emit(SAX_END_OBJECT, cursor - 1) == -1) return -1;
   return 0;
 }
 
@@ -197,50 +424,256 @@ static char parse_object(TOKEN* ta) {
  *
  * @returns 0 on success and -1 on failure
  */
-static char parse_array(TOKEN* ta) {
+static char parse_array(void) {
   if (depth > MAX_DEPTH) {
     fprintf(stderr, "Nesting in JSON file exceeds safe limit (%d). Aborting!\n", MAX_DEPTH);
     return -1;
   }
 
   char res = 0;
-  res = eat(BEGIN_ARRAY, ta);
+  res = eat(BEGIN_ARRAY);
   if (res == -1) return -1;
-  TOKEN currentToken = ta[cursor];
+  if (saxHandler && emit(SAX_START_ARRAY, cursor - 1) == -1) return -1;
+  TOKEN currentToken = peek();
 
   while (currentToken != END_ARRAY) {
-    res = parse_value(ta);
+    res = parse_value();
     if (res == -1) return -1;
 
     // array is over
-    if (ta[cursor] == END_ARRAY) {
+    if (peek() == END_ARRAY) {
       break;
     }
 
     // array has more entries
-    if (ta[cursor] == VALUE_SEPARATOR) {
-      res = eat(VALUE_SEPARATOR, ta);
+    if (peek() == VALUE_SEPARATOR) {
+      res = eat(VALUE_SEPARATOR);
       if (res == -1) return -1;
 
       // if previous token is a comma and the array is already closed, this is invalid
       // a following value is expected in this case
-      if (ta[cursor] == END_ARRAY) {
+      if (peek() == END_ARRAY) {
         fprintf(stderr, "Trailing comma in array!\n");
         return -1;
       }
     }
-    currentToken = ta[cursor];
+    currentToken = peek();
   }
 
-  res = eat(END_ARRAY, ta);
+  res = eat(END_ARRAY);
   if (res == -1) return -1;
+  if (saxHandler && emit(SAX_END_ARRAY, cursor - 1) == -1) return -1;
   return 0;
 }
 
+/**
+ * Maps a simple value token to the event reporting it.
+ */
+static inline SaxEventType scalar_event(TOKEN tk) {
+  switch (tk) {
+    case STRING:
+      return SAX_STRING;
+    case NUMBER:
+      return SAX_NUMBER;
+    case LITERAL_TRUE:
+      return SAX_TRUE;
+    case LITERAL_FALSE:
+      return SAX_FALSE;
+    default:
+      return SAX_NULL;
+  }
+}
+
+/**
+ * Buffers the event `type` for the token at `tokenIdx`,
+ * handing the batch over to `saxHandler` once it is full.
+ *
+ * @returns 0 on success and -1 if the handler asked to stop
+ */
+static inline char emit(SaxEventType type, size_t tokenIdx) {
+  SaxEvent* event = &saxEvents[saxCount++];
+  event->type = type;
+  event->depth = (uint32_t)depth;
+  event->offset = spans[tokenIdx].offset;
+  event->length = spans[tokenIdx].length;
+
+  if (saxCount == SAX_BATCH_SIZE) {
+    return flush_events();
+  }
+  return 0;
+}
+
+/**
+ * @returns 0 on success and -1 if the handler asked to stop
+ */
+static char flush_events(void) {
+  size_t count = saxCount;
+  saxCount = 0;
+
+  if (saxHandler->onEvents(saxEvents, count, saxHandler->ctx) != 0) {
+    fprintf(stderr, "Parse: SAX handler stopped parsing\n");
+    return -1;
+  }
+  return 0;
+}
+
+static size_t stopped_at(void) {
+  if (!spans) return 0;
+  if (cursor < tokenCount) return spans[cursor].offset;
+  if (tokenCount == 0) return consumedEnd;
+
+  const Span* last = &spans[tokenCount - 1];
+  return last->offset + last->length;
+}
+
+/**
+ * Frees the key sets and resets the parser for the next document on this thread.
+ */
+static void finish_parse(void) {
+  if (uniqueKeys) free_key_sets();
+  depth = 0;
+  tokens = NULL;
+  tokenCount = 0;
+  cursor = 0;
+  uniqueKeys = 0;
+  keyIds = NULL;
+  keyCount = 0;
+  keyCursor = 0;
+  allocator = NULL;
+  saxHandler = NULL;
+  spans = NULL;
+  saxCount = 0;
+}
+
 static void free_token_stream(TokenStream* ts) {
   if (!ts) {
     return;
   }
-  free(ts->tokenArray);
-  free(ts);
+  const JsonAllocator* a = ts->allocator;
+  MemoryBudget* budget = ts->budget;  // `a` lives in it, so it goes last
+  JsonFree(a, ts->tokenArray);
+  JsonFree(a, ts->spans);
+  JsonFree(a, ts->keyIds);
+  JsonFree(a, ts);
+  FreeMemoryBudget(budget);
+}
+
+/**
+ * Empties `set` so the next object at its nesting level can reuse it.
+ */
+static void begin_key_set(KeySet* set) {
+  set->count = 0;
+  set->generation++;
+
+  // stamps from 2^32 objects ago would look current again, so clear them on wraparound
+  if (set->generation == 0) {
+    if (set->stamps) memset(set->stamps, 0, set->capacity * sizeof(uint32_t));
+    set->generation = 1;
+  }
+}
+
+/**
+ * Adds the member name `id` to `set`.
+ *
+ * Interned ids are small and dense, so they index the table directly
+ * instead of being hashed again.
+ *
+ * @returns 0 on success and -1 if `id` is already in `set` or memory ran out
+ */
+static char insert_key(KeySet* set, uint32_t id) {
+  if ((set->count + 1) * 2 > set->capacity && grow_key_set(set) == -1) {
+    return -1;
+  }
+
+  size_t mask = set->capacity - 1;
+  size_t idx = id & mask;
+  while (set->stamps[idx] == set->generation) {
+    if (set->slots[idx] == id) {
+      report_duplicate(id);
+      return -1;
+    }
+    idx = (idx + 1) & mask;
+  }
+
+  set->slots[idx] = id;
+  set->stamps[idx] = set->generation;
+  set->count++;
+  return 0;
+}
+
+/**
+ * @returns the next entry of `keyIds`, `INTERN_FAILED` if there are none left
+ */
+static inline uint32_t next_key_id(void) {
+  if (keyCursor == keyCount) {
+    fprintf(stderr, "parse_object: ran out of member names!\n");
+    return INTERN_FAILED;
+  }
+  return keyIds[keyCursor++];
+}
+
+/**
+ * Moves the object that left `shape` over to this nesting level's `KeySet`,
+ * once one of its keys repeated or no longer fit in a shape.
+ *
+ * @returns the key set holding every key of `shape`, `NULL` on failure
+ */
+static KeySet* leave_shape(uint32_t shape) {
+  KeySet* set = &keySets[depth];
+  begin_key_set(set);
+
+  uint32_t keys[MAX_SHAPE_KEYS];
+  size_t count = ShapeKeys(shape, keys);
+  for (size_t i = 0; i < count; i++) {
+    if (insert_key(set, keys[i]) == -1) return NULL;
+  }
+  return set;
+}
+
+static void report_duplicate(uint32_t id) {
+  size_t len = 0;
+  const char* key = InternedKey(id, &len);
+  fprintf(stderr, "parse_object: duplicate key \"%.*s\" in object!\n", (int)len, key);
+}
+
+/**
+ * Doubles the capacity of `set`, carrying over the keys of the current object.
+ *
+ * @returns 0 on success and -1 on failure
+ */
+static char grow_key_set(KeySet* set) {
+  size_t newCapacity = set->capacity ? set->capacity * 2 : INITIAL_KEY_SLOTS;
+  uint32_t* slots = (uint32_t*)JsonAlloc(allocator, newCapacity * sizeof(uint32_t));
+  uint32_t* stamps = (uint32_t*)JsonCalloc(allocator, newCapacity, sizeof(uint32_t));
+  if (!slots || !stamps) {
+    fprintf(stderr, "parse_object: failed to grow key set!\n");
+    JsonFree(allocator, slots);
+    JsonFree(allocator, stamps);
+    return -1;
+  }
+
+  size_t mask = newCapacity - 1;
+  for (size_t i = 0; i < set->capacity; i++) {
+    if (set->stamps[i] != set->generation) continue;
+    size_t idx = set->slots[i] & mask;
+    while (stamps[idx] == 1) idx = (idx + 1) & mask;
+    slots[idx] = set->slots[i];
+    stamps[idx] = 1;
+  }
+
+  JsonFree(allocator, set->slots);
+  JsonFree(allocator, set->stamps);
+  set->slots = slots;
+  set->stamps = stamps;
+  set->capacity = newCapacity;
+  set->generation = 1;
+  return 0;
+}
+
+static void free_key_sets(void) {
+  for (size_t i = 0; i < sizeof(keySets) / sizeof(keySets[0]); i++) {
+    JsonFree(allocator, keySets[i].slots);
+    JsonFree(allocator, keySets[i].stamps);
+    memset(&keySets[i], 0, sizeof(KeySet));
+  }
 }
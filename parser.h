@@ -1,8 +1,17 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdio.h>
+
+#include "lexer.h"
+#include "options.h"
+#include "sax.h"
 #include "token.h"
 
 int Parse(TokenStream* ts);
+int ParseWithHandler(TokenStream* ts, const SaxHandler* handler);
+int ParseStream(FILE* file, const JsonOptions* opts, const SaxHandler* handler);
+int ParseLexer(Lexer* source, const JsonOptions* opts, const SaxHandler* handler);
+size_t ParseErrorOffset(void);
 
 #endif
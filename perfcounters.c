@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include "perfcounters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define L1D_READ_MISS \
+  (PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#define LLC_READ_MISS \
+  (PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/**
+ * How to ask `perf_event_open` for each `CounterKind`
+ */
+static const struct {
+  const char* name;
+  uint32_t type;
+  uint64_t config;
+} events[COUNTER_KINDS] = {
+    [COUNTER_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [COUNTER_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [COUNTER_BRANCH_MISSES] = {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [COUNTER_L1D_MISSES] = {"L1d-misses", PERF_TYPE_HW_CACHE, L1D_READ_MISS},
+    [COUNTER_LLC_MISSES] = {"LLC-misses", PERF_TYPE_HW_CACHE, LLC_READ_MISS},
+};
+
+/**
+ * Layout `read` fills with `PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING`
+ */
+typedef struct {
+  uint64_t value;
+  uint64_t timeEnabled;
+  uint64_t timeRunning;
+} CounterReading;
+
+static int open_event(CounterKind kind);
+static char read_counter(int fd, CounterReading* reading);
+static double now_seconds(void);
+
+/**
+ * Opens every counter `counters` supports for the calling thread, disabled.
+ * Threads it starts afterwards, like the decompressor `OpenJsonInput` runs,
+ * are counted too, as their work is part of the phases being measured.
+ * Counters are often missing in containers and VMs (see `perf_event_paranoid`),
+ * in which case the reason is printed and `counters` still measures wall clock time.
+ *
+ * @returns 0 if at least one counter could be opened, -1 otherwise
+ */
+char OpenPerfCounters(PerfCounters* counters) {
+  char opened = 0;
+  int firstError = 0;
+
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    counters->fds[i] = open_event((CounterKind)i);
+    if (counters->fds[i] != -1) {
+      opened = 1;
+    } else if (!firstError) {
+      firstError = errno;
+    }
+  }
+  counters->startSeconds = 0;
+
+  if (!opened) {
+    fprintf(stderr, "OpenPerfCounters: no hardware counters available (%s), only timing phases\n", strerror(firstError));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Takes the current reading of every open counter of `counters` and enables it.
+ * Counts are measured from that reading rather than reset: `PERF_EVENT_IOC_RESET`
+ * leaves out what threads that already exited, like a finished decompressor, had counted.
+ */
+void StartPerfCounters(PerfCounters* counters) {
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    if (counters->fds[i] == -1) continue;
+    CounterReading reading = {0};
+    read_counter(counters->fds[i], &reading);
+    counters->startValues[i] = reading.value;
+    counters->startEnabled[i] = reading.timeEnabled;
+    counters->startRunning[i] = reading.timeRunning;
+    ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+  counters->startSeconds = now_seconds();
+}
+
+/**
+ * Disables every open counter of `counters` and stores what they
+ * counted since `StartPerfCounters` in `sample`.
+ */
+void StopPerfCounters(PerfCounters* counters, CounterSample* sample) {
+  double stopSeconds = now_seconds();
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    if (counters->fds[i] != -1) ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  sample->seconds = stopSeconds - counters->startSeconds;
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    CounterReading reading;
+    sample->values[i] = 0;
+    sample->available[i] = 0;
+
+    if (counters->fds[i] == -1 || read_counter(counters->fds[i], &reading) == -1) continue;
+    uint64_t value = reading.value - counters->startValues[i];
+    uint64_t timeEnabled = reading.timeEnabled - counters->startEnabled[i];
+    uint64_t timeRunning = reading.timeRunning - counters->startRunning[i];
+    if (timeRunning == 0) continue;  // never got a hardware counter
+
+    // the kernel time-shares counters when more events are open than the PMU has, so extrapolate
+    double scale = (double)timeEnabled / timeRunning;
+    sample->values[i] = (uint64_t)(value * scale);
+    sample->available[i] = 1;
+  }
+}
+
+void ClosePerfCounters(PerfCounters* counters) {
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    if (counters->fds[i] != -1) close(counters->fds[i]);
+    counters->fds[i] = -1;
+  }
+}
+
+const char* CounterName(CounterKind kind) {
+  return events[kind].name;
+}
+
+/**
+ * @returns the file descriptor of a disabled, user space only counter of `kind`
+ * on the calling thread and its future threads, -1 with `errno` set on failure
+ */
+static int open_event(CounterKind kind) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = events[kind].type;
+  attr.config = events[kind].config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;  // allowed at `perf_event_paranoid` 2, and the lexer's `read`s are not ours to tune
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.inherit = 1;  // also counts threads created later, which rules out `PERF_FORMAT_GROUP`
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * @returns 0 on success, -1 on failure
+ */
+static char read_counter(int fd, CounterReading* reading) {
+  return read(fd, reading, sizeof(*reading)) == sizeof(*reading) ? 0 : -1;
+}
+
+static double now_seconds(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,47 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Hardware events counted by `PerfCounters`
+ */
+typedef enum {
+  COUNTER_CYCLES = 0,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_BRANCH_MISSES,
+  COUNTER_L1D_MISSES,  // L1 data cache read misses
+  COUNTER_LLC_MISSES,  // last level cache read misses
+  COUNTER_KINDS,
+} CounterKind;
+
+/**
+ * Counters of the calling thread and the threads it starts, user space only.
+ * Each one is opened on its own, so a CPU or container lacking some events still gets the others.
+ */
+typedef struct {
+  int fds[COUNTER_KINDS];  // -1 for events that could not be opened
+  uint64_t startValues[COUNTER_KINDS];  // readings at `StartPerfCounters`, as the counts of exited threads can't be reset
+  uint64_t startEnabled[COUNTER_KINDS];
+  uint64_t startRunning[COUNTER_KINDS];
+  double startSeconds;
+} PerfCounters;
+
+/**
+ * What a `StartPerfCounters`/`StopPerfCounters` pair measured.
+ * Values are scaled up when the kernel multiplexed a counter,
+ * `available` is 0 for events that were not counted at all.
+ */
+typedef struct {
+  uint64_t values[COUNTER_KINDS];
+  char available[COUNTER_KINDS];
+  double seconds;  // wall clock, measured even without counters
+} CounterSample;
+
+char OpenPerfCounters(PerfCounters* counters);
+void StartPerfCounters(PerfCounters* counters);
+void StopPerfCounters(PerfCounters* counters, CounterSample* sample);
+void ClosePerfCounters(PerfCounters* counters);
+const char* CounterName(CounterKind kind);
+
+#endif
@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include "project.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inplace.h"
+
+#define STRING_DATA_INITIAL_CAPACITY 4096  // bytes of string data per column before its first growth
+#define LINE_INITIAL_CAPACITY 4096         // bytes of a record before the line buffer's first growth
+
+/**
+ * A column's path split on dots. Components are compared against decoded keys.
+ */
+typedef struct {
+  char* components[MAX_PATH_COMPONENTS];
+  size_t lengths[MAX_PATH_COMPONENTS];
+  size_t count;
+} FieldPath;
+
+/**
+ * The value the current record holds for a column, pointing into the line
+ * buffer. Only appended to the columns once the whole record validated.
+ */
+typedef struct {
+  char found;
+  uint32_t type;  // a `SaxEventType`
+  const char* text;
+  size_t length;
+} StagedValue;
+
+struct Projection {
+  JsonOptions opts;  // every record is parsed with these, and the projection allocated through `opts.allocator`
+  Column* columns;
+  FieldPath* paths;
+  StagedValue* staged;
+  size_t columnCount;
+  size_t rowGroupSize;
+  size_t rows;  // in the current row group
+  size_t totalRows;
+  size_t invalidRecords;
+  RowGroupCallback onRowGroup;
+  void* ctx;
+
+  // where the parser is inside the current record
+  char* line;
+  size_t lineCapacity;
+  const char* keys[MAX_PATH_COMPONENTS + 1];  // innermost key per nesting level, 1 based
+  size_t keyLengths[MAX_PATH_COMPONENTS + 1];
+  size_t objectDepth;  // nesting levels 1..objectDepth are all objects, so their keys form a path
+};
+
+static char* copy_string(const JsonAllocator* allocator, const char* text, size_t length);
+static ssize_t read_line(Projection* p, FILE* input);
+static char split_path(FieldPath* path, const char* spec, const JsonAllocator* allocator);
+static int stage_values(const SaxEvent* events, size_t count, void* ctx);
+static void stage_scalar(Projection* p, const SaxEvent* ev);
+static char append_row(Projection* p);
+static char append_string(Column* c, size_t row, const char* text, size_t length, const JsonAllocator* allocator);
+static char flush_row_group(Projection* p);
+
+/**
+ * Creates a projection of the fields `specs` (`count` of them) out of NDJSON
+ * records, delivering `rowGroupSize` rows at a time to `onRowGroup`.
+ * Every record is parsed with `opts` (which may be `NULL`), and the projection's
+ * columns and line buffer are allocated through `opts->allocator`, which must
+ * outlive it.
+ *
+ * @returns the projection, or `NULL` if a path is malformed or allocation failed
+ */
+Projection* CreateProjection(const ColumnSpec* specs, size_t count, size_t rowGroupSize, const JsonOptions* opts,
+                             RowGroupCallback onRowGroup, void* ctx) {
+  if (!specs || count == 0 || rowGroupSize == 0 || !onRowGroup) {
+    fprintf(stderr, "CreateProjection: needs at least one column, a row group size and a callback!\n");
+    return NULL;
+  }
+
+  const JsonAllocator* allocator = opts ? opts->allocator : NULL;
+  Projection* p = (Projection*)JsonCalloc(allocator, 1, sizeof(Projection));
+  if (!p) goto on_error;
+  if (opts) p->opts = *opts;
+  p->columnCount = count;
+  p->rowGroupSize = rowGroupSize;
+  p->onRowGroup = onRowGroup;
+  p->ctx = ctx;
+
+  p->columns = (Column*)JsonCalloc(allocator, count, sizeof(Column));
+  p->paths = (FieldPath*)JsonCalloc(allocator, count, sizeof(FieldPath));
+  p->staged = (StagedValue*)JsonCalloc(allocator, count, sizeof(StagedValue));
+  if (!p->columns || !p->paths || !p->staged) goto on_error;
+
+  for (size_t i = 0; i < count; i++) {
+    Column* c = &p->columns[i];
+    c->spec.type = specs[i].type;
+    c->spec.path = specs[i].path ? copy_string(allocator, specs[i].path, strlen(specs[i].path)) : NULL;
+    if (!c->spec.path || split_path(&p->paths[i], c->spec.path, allocator) == -1) {
+      fprintf(stderr, "CreateProjection: invalid field path \"%s\"!\n", specs[i].path ? specs[i].path : "(null)");
+      goto on_error;
+    }
+
+    c->validity = (uint8_t*)JsonCalloc(allocator, (rowGroupSize + 7) / 8, 1);
+    if (!c->validity) goto on_error;
+
+    switch (c->spec.type) {
+      case COLUMN_INT64:
+        c->ints = (int64_t*)JsonCalloc(allocator, rowGroupSize, sizeof(int64_t));
+        if (!c->ints) goto on_error;
+        break;
+      case COLUMN_DOUBLE:
+        c->doubles = (double*)JsonCalloc(allocator, rowGroupSize, sizeof(double));
+        if (!c->doubles) goto on_error;
+        break;
+      case COLUMN_STRING:
+        c->stringOffsets = (uint32_t*)JsonCalloc(allocator, rowGroupSize + 1, sizeof(uint32_t));
+        c->stringData = (char*)JsonAlloc(allocator, STRING_DATA_INITIAL_CAPACITY);
+        if (!c->stringOffsets || !c->stringData) goto on_error;
+        c->stringCapacity = STRING_DATA_INITIAL_CAPACITY;
+        break;
+      default:
+        fprintf(stderr, "CreateProjection: unknown column type %d!\n", (int)c->spec.type);
+        goto on_error;
+    }
+  }
+
+  return p;
+
+on_error:
+  if (!p) fprintf(stderr, "CreateProjection: failed to allocate memory!\n");
+  FreeProjection(p);
+  return NULL;
+}
+
+/**
+ * Reads `input` one NDJSON record (line) at a time, validates it and appends
+ * the projected fields as one row. Invalid records are counted and skipped,
+ * blank lines are ignored. Strings are decoded in place in the line buffer
+ * and copied straight into their column, so no record is ever materialized.
+ * Each record is a separate document for the projection's `JsonOptions`:
+ * one with duplicate keys or over `memoryLimit` counts as invalid.
+ *
+ * @returns 0 once every record was projected and delivered, -1 if allocation failed or the callback stopped it
+ */
+int ProjectNdjson(Projection* p, FILE* input) {
+  if (!p || !input) {
+    fprintf(stderr, "ProjectNdjson: missing projection or input!\n");
+    return -1;
+  }
+
+  int res = -1;
+  size_t lineNumber = 0;
+  ssize_t read;
+  SaxHandler handler = {stage_values, p};
+  flockfile(input);  // `read_line` reads it unlocked
+
+  while ((read = read_line(p, input)) > 0) {
+    lineNumber++;
+    size_t len = (size_t)read;
+    while (len > 0 && (p->line[len - 1] == '\n' || p->line[len - 1] == '\r')) len--;
+    if (len == 0) continue;
+
+    memset(p->staged, 0, p->columnCount * sizeof(StagedValue));
+    p->objectDepth = 0;
+
+    if (ParseInPlace(p->line, len, &p->opts, &handler) != 0) {
+      fprintf(stderr, "ProjectNdjson: skipping invalid record on line %zu\n", lineNumber);
+      p->invalidRecords++;
+      continue;
+    }
+
+    if (append_row(p) == -1) goto on_cleanup;
+    if (p->rows == p->rowGroupSize && flush_row_group(p) == -1) goto on_cleanup;
+  }
+
+  if (read == -1) goto on_cleanup;
+  if (p->rows > 0 && flush_row_group(p) == -1) goto on_cleanup;
+  res = 0;
+
+on_cleanup:
+  funlockfile(input);
+  JsonFree(p->opts.allocator, p->line);
+  p->line = NULL;
+  p->lineCapacity = 0;
+  return res;
+}
+
+size_t ProjectedRows(const Projection* p) {
+  return p ? p->totalRows : 0;
+}
+
+size_t InvalidRecords(const Projection* p) {
+  return p ? p->invalidRecords : 0;
+}
+
+void FreeProjection(Projection* p) {
+  if (!p) return;
+  const JsonAllocator* allocator = p->opts.allocator;
+
+  for (size_t i = 0; p->columns && i < p->columnCount; i++) {
+    Column* c = &p->columns[i];
+    JsonFree(allocator, (char*)c->spec.path);
+    JsonFree(allocator, c->ints);
+    JsonFree(allocator, c->doubles);
+    JsonFree(allocator, c->stringOffsets);
+    JsonFree(allocator, c->stringData);
+    JsonFree(allocator, c->validity);
+  }
+  for (size_t i = 0; p->paths && i < p->columnCount; i++) {
+    for (size_t j = 0; j < p->paths[i].count; j++) JsonFree(allocator, p->paths[i].components[j]);
+  }
+
+  JsonFree(allocator, p->columns);
+  JsonFree(allocator, p->paths);
+  JsonFree(allocator, p->staged);
+  JsonFree(allocator, p->line);
+  JsonFree(allocator, p);
+}
+
+/**
+ * @returns a NUL terminated copy of the `length` bytes of `text`, `NULL` on failure
+ */
+static char* copy_string(const JsonAllocator* allocator, const char* text, size_t length) {
+  char* copy = (char*)JsonAlloc(allocator, length + 1);
+  if (!copy) return NULL;
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+/**
+ * Reads the next line of `input`, newline included, into `p->line`,
+ * growing it through the projection's allocator.
+ *
+ * @returns its length, 0 at the end of the input, -1 if the buffer could not grow
+ */
+static ssize_t read_line(Projection* p, FILE* input) {
+  size_t len = 0;
+  int ch;
+
+  while ((ch = getc_unlocked(input)) != EOF) {
+    if (len == p->lineCapacity) {
+      size_t capacity = p->lineCapacity ? p->lineCapacity * 2 : LINE_INITIAL_CAPACITY;
+      char* grown = (char*)JsonRealloc(p->opts.allocator, p->line, capacity);
+      if (!grown) {
+        fprintf(stderr, "ProjectNdjson: failed to grow the line buffer!\n");
+        return -1;
+      }
+      p->line = grown;
+      p->lineCapacity = capacity;
+    }
+
+    p->line[len++] = (char)ch;
+    if (ch == '\n') break;
+  }
+  return (ssize_t)len;
+}
+
+/**
+ * Splits `spec` on dots into `path`.
+ *
+ * @returns 0 on success, -1 for empty components, too many of them, or failed allocation
+ */
+static char split_path(FieldPath* path, const char* spec, const JsonAllocator* allocator) {
+  const char* start = spec;
+
+  for (;;) {
+    const char* dot = strchr(start, '.');
+    size_t len = dot ? (size_t)(dot - start) : strlen(start);
+    if (len == 0 || path->count == MAX_PATH_COMPONENTS) return -1;
+
+    char* component = copy_string(allocator, start, len);
+    if (!component) return -1;
+    path->components[path->count] = component;
+    path->lengths[path->count] = len;
+    path->count++;
+
+    if (!dot) return 0;
+    start = dot + 1;
+  }
+}
+
+/**
+ * `SaxBatchCallback` tracking the key path of the current record
+ * and staging the scalars found at a projected path.
+ */
+static int stage_values(const SaxEvent* events, size_t count, void* ctx) {
+  Projection* p = (Projection*)ctx;
+
+  for (size_t i = 0; i < count; i++) {
+    const SaxEvent* ev = &events[i];
+
+    switch (ev->type) {
+      case SAX_START_OBJECT:
+        if (p->objectDepth + 1 == ev->depth && ev->depth <= MAX_PATH_COMPONENTS) {
+          p->objectDepth = ev->depth;
+          p->keys[ev->depth] = NULL;
+        }
+        break;
+      case SAX_END_OBJECT:
+      case SAX_START_ARRAY:
+      case SAX_END_ARRAY:
+        if (p->objectDepth >= ev->depth) p->objectDepth = ev->depth - 1;
+        break;
+      case SAX_KEY:
+        if (ev->depth == p->objectDepth) {
+          p->keys[ev->depth] = p->line + ev->offset;
+          p->keyLengths[ev->depth] = ev->length;
+        }
+        break;
+      default:
+        if (ev->depth == p->objectDepth) stage_scalar(p, ev);
+        break;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Stages `ev` for every column whose path is the current key path.
+ */
+static void stage_scalar(Projection* p, const SaxEvent* ev) {
+  size_t depth = ev->depth;
+
+  for (size_t i = 0; i < p->columnCount; i++) {
+    const FieldPath* path = &p->paths[i];
+    if (path->count != depth) continue;
+
+    char matches = 1;
+    for (size_t d = 0; matches && d < depth; d++) {
+      matches = p->keyLengths[d + 1] == path->lengths[d] && memcmp(p->keys[d + 1], path->components[d], path->lengths[d]) == 0;
+    }
+    if (!matches) continue;
+
+    StagedValue* s = &p->staged[i];
+    s->found = 1;  // a repeated key overrides the earlier value, like most JSON readers do
+    s->type = ev->type;
+    s->text = p->line + ev->offset;
+    s->length = ev->length;
+  }
+}
+
+/**
+ * Converts the staged values of the record just validated into row `p->rows`.
+ * Values of the wrong JSON type, and numbers out of range for the column, become nulls.
+ *
+ * @returns 0 on success, -1 if string data could not grow
+ */
+static char append_row(Projection* p) {
+  size_t row = p->rows;
+
+  for (size_t i = 0; i < p->columnCount; i++) {
+    Column* c = &p->columns[i];
+    const StagedValue* s = &p->staged[i];
+    char valid = 0;
+    char* end = NULL;
+
+    switch (c->spec.type) {
+      case COLUMN_INT64:
+        c->ints[row] = 0;
+        if (s->found && s->type == SAX_NUMBER) {
+          errno = 0;
+          long long value = strtoll(s->text, &end, 10);
+          if (errno == 0 && end == s->text + s->length) {  // fractions and exponents don't fit either
+            c->ints[row] = value;
+            valid = 1;
+          }
+        }
+        break;
+      case COLUMN_DOUBLE:
+        c->doubles[row] = 0;
+        if (s->found && s->type == SAX_NUMBER) {
+          errno = 0;
+          double value = strtod(s->text, &end);
+          if (errno == 0 && end == s->text + s->length) {
+            c->doubles[row] = value;
+            valid = 1;
+          }
+        }
+        break;
+      case COLUMN_STRING:
+        valid = s->found && s->type == SAX_STRING;
+        if (append_string(c, row, valid ? s->text : NULL, valid ? s->length : 0, p->opts.allocator) == -1) return -1;
+        break;
+    }
+
+    if (valid) c->validity[row / 8] |= (uint8_t)(1u << (row % 8));
+  }
+
+  p->rows++;
+  return 0;
+}
+
+/**
+ * Appends `length` bytes of `text` as row `row` of the string column `c`, growing it through `allocator`.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char append_string(Column* c, size_t row, const char* text, size_t length, const JsonAllocator* allocator) {
+  size_t needed = c->stringBytes + length;
+  if (needed > UINT32_MAX) {
+    fprintf(stderr, "append_string: row group string data of \"%s\" exceeds 4 GiB!\n", c->spec.path);
+    return -1;
+  }
+
+  if (needed > c->stringCapacity) {
+    size_t capacity = c->stringCapacity * 2;
+    while (capacity < needed) capacity *= 2;
+    char* grown = (char*)JsonRealloc(allocator, c->stringData, capacity);
+    if (!grown) {
+      fprintf(stderr, "append_string: failed to reallocate memory!\n");
+      return -1;
+    }
+    c->stringData = grown;
+    c->stringCapacity = capacity;
+  }
+
+  if (length > 0) memcpy(c->stringData + c->stringBytes, text, length);
+  c->stringBytes = needed;
+  c->stringOffsets[row + 1] = (uint32_t)needed;
+  return 0;
+}
+
+/**
+ * Hands the current row group to the callback and resets the columns for the next one.
+ *
+ * @returns 0 on success, -1 if the callback asked to stop
+ */
+static char flush_row_group(Projection* p) {
+  int stop = p->onRowGroup(p->columns, p->columnCount, p->rows, p->ctx);
+  p->totalRows += p->rows;
+
+  for (size_t i = 0; i < p->columnCount; i++) {
+    Column* c = &p->columns[i];
+    memset(c->validity, 0, (p->rowGroupSize + 7) / 8);
+    c->stringBytes = 0;
+  }
+  p->rows = 0;
+
+  return stop ? -1 : 0;
+}
@@ -0,0 +1,63 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "options.h"
+
+#define MAX_PATH_COMPONENTS 8  // deepest field path a projection can select, e.g. `a.b.c` has 3
+
+/**
+ * Type a projected field is converted to. Values of any other JSON type,
+ * numbers that don't fit, and missing fields become nulls.
+ */
+typedef enum {
+  COLUMN_INT64 = 0,
+  COLUMN_DOUBLE,
+  COLUMN_STRING,
+} ColumnType;
+
+/**
+ * One field to project: `path` names nested object members separated by dots (`user.id`)
+ */
+typedef struct {
+  const char* path;
+  ColumnType type;
+} ColumnSpec;
+
+/**
+ * Values of one field for the rows of the current row group.
+ * Fields:
+ * - `ints` / `doubles` one slot per row, for `COLUMN_INT64` / `COLUMN_DOUBLE`
+ * - `stringOffsets` row `i` of a `COLUMN_STRING` is `stringData[stringOffsets[i], stringOffsets[i + 1])`, decoded UTF-8
+ * - `validity` bit `i` (LSB first) is set when row `i` is not null
+ */
+typedef struct {
+  ColumnSpec spec;
+  int64_t* ints;
+  double* doubles;
+  uint32_t* stringOffsets;
+  char* stringData;
+  size_t stringBytes;
+  size_t stringCapacity;
+  uint8_t* validity;
+} Column;
+
+/**
+ * Receives each full row group (and the last partial one). The column
+ * buffers are reused afterwards, so copy out what must outlive the call.
+ * Returning nonzero stops the projection.
+ */
+typedef int (*RowGroupCallback)(const Column* columns, size_t columnCount, size_t rows, void* ctx);
+
+typedef struct Projection Projection;
+
+Projection* CreateProjection(const ColumnSpec* specs, size_t count, size_t rowGroupSize, const JsonOptions* opts,
+                             RowGroupCallback onRowGroup, void* ctx);
+int ProjectNdjson(Projection* p, FILE* input);
+size_t ProjectedRows(const Projection* p);
+size_t InvalidRecords(const Projection* p);
+void FreeProjection(Projection* p);
+
+#endif
@@ -1,11 +1,61 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "allocator.h"
+#include "batch.h"
 #include "build_config.h"
+#include "decompress.h"
+#include "inplace.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
+#include "perfcounters.h"
+#include "project.h"
+#include "server.h"
+#include "sidecar.h"
 
 static void run_test(const char* testName, const char* jsonFilePath, const int expected);
+static void run_test_with_options(const char* testName, const char* jsonFilePath, const int expected, const JsonOptions* opts);
+static void run_index_test(void);
+static void run_batch_test(const char* testName, size_t workers);
+static void run_allocator_test(const char* testName, const char* jsonFilePath, const int expected, JsonOptions opts);
+static void* counting_alloc(void* ctx, size_t size);
+static void* counting_realloc(void* ctx, void* ptr, size_t size);
+static void counting_free(void* ctx, void* ptr);
+static void run_shape_test(const char* testName, char repeatKey);
+static void run_intern_budget_test(void);
+static void run_sax_test(const char* testName, const char* jsonFilePath, const char* expectedEvents, size_t expectedCount);
+static int collect_events(const SaxEvent* events, size_t count, void* ctx);
+static void run_in_place_test(void);
+static int collect_strings(const SaxEvent* events, size_t count, void* ctx);
+static void run_projection_test(void);
+static int render_rows(const Column* columns, size_t columnCount, size_t rows, void* ctx);
+static void run_server_test(void);
+static void run_perf_counter_test(void);
+static char count_phases(const char* jsonFilePath, CounterSample phases[2], size_t* size, char* haveCounters);
+static void* serve_in_background(void* arg);
+
+/**
+ * What `collect_events` saw: one char per event (up to `MAX_RECORDED_EVENTS`),
+ * plus totals and the text of the first key and number, taken from their spans
+ */
+#define MAX_RECORDED_EVENTS 64
+#define SAX_MEMORY_LIMIT (256u << 10)  // far below the token stream of `2_million_ints_4M.json`
+typedef struct {
+  FILE* fp;
+  FILE* input;               // the handle being parsed
+  long readAtFirstBatch;     // how far into `input` the first batch arrived
+  char events[MAX_RECORDED_EVENTS + 1];
+  size_t count;
+  size_t batches;
+  char firstKey[16];
+  char firstNumber[16];
+} SaxRecording;
 
 int main() {
   run_test("Step 1, valid JSON", "tests/step1/valid.json", 0);
@@ -64,21 +114,98 @@ int main() {
   run_test("Custom step", "tests/custom/more_than_one_root.json", -1);
   run_test("Custom step", "tests/custom/2_million_ints_4M.json", 0);
 
+  JsonOptions uniqueKeys = {0};
+  uniqueKeys.rejectDuplicateKeys = 1;
+  run_test("Duplicate keys allowed by default", "tests/custom/duplicate_keys.json", 0);
+  run_test_with_options("Duplicate keys", "tests/custom/duplicate_keys.json", -1, &uniqueKeys);
+  run_test_with_options("Nested duplicate keys", "tests/custom/nested_duplicate_keys.json", -1, &uniqueKeys);
+  run_test_with_options("Unique keys", "tests/custom/unique_keys.json", 0, &uniqueKeys);
+  run_test_with_options("Escaped duplicate keys", "tests/custom/escaped_duplicate_keys.json", -1, &uniqueKeys);
+  run_test_with_options("Unique keys step 5 pass1", "tests/step5/pass1.json", 0, &uniqueKeys);
+  run_test_with_options("Duplicate keys in a cached shape", "tests/custom/shaped_duplicate_keys.json", -1, &uniqueKeys);
+  run_shape_test("Shapes of unique records", 0);
+  run_shape_test("Duplicate key past the longest shape", 1);
+  FreeInternTable();
+
+  JsonOptions pooled = {0};
+  pooled.allocator = ThreadPoolAllocator();
+  pooled.rejectDuplicateKeys = 1;
+  run_test_with_options("Pooled step 5 pass1", "tests/step5/pass1.json", 0, &pooled);
+  run_test_with_options("Pooled duplicate keys", "tests/custom/nested_duplicate_keys.json", -1, &pooled);
+  run_test_with_options("Pooled 2 million ints", "tests/custom/2_million_ints_4M.json", 0, &pooled);
+  FreeThreadPool();
+  FreeInternTable();
+
+  JsonOptions tight = {0};
+  tight.memoryLimit = 1 << 20;
+  run_test_with_options("Memory limit exceeded", "tests/custom/2_million_ints_4M.json", -1, &tight);
+  JsonOptions roomy = {0};
+  roomy.memoryLimit = 64 << 20;
+  run_test_with_options("Memory limit respected", "tests/custom/2_million_ints_4M.json", 0, &roomy);
+  run_intern_budget_test();
+
+  JsonOptions counted = {0};
+  run_allocator_test("Custom allocator", "tests/step5/pass1.json", 0, counted);
+  counted.rejectDuplicateKeys = 1;
+  counted.recordSpans = 1;
+  run_allocator_test("Custom allocator with keys and spans", "tests/step5/pass1.json", 0, counted);
+  run_allocator_test("Custom allocator on duplicate keys", "tests/custom/nested_duplicate_keys.json", -1, counted);
+  run_allocator_test("Custom allocator on a lexing error", "tests/step5/fail15.json", -1, counted);
+  counted.memoryLimit = 4096;
+  run_allocator_test("Custom allocator under a memory limit", "tests/custom/2_million_ints_4M.json", -1, counted);
+  FreeInternTable();
+
+  run_test("Gzip step 5 pass1", "tests/custom/pass1.json.gz", 0);
+  run_test("Gzip step 5 fail2", "tests/custom/fail2.json.gz", -1);
+  run_test("Gzip across many blocks", "tests/custom/2_million_ints_4M.json.gz", 0);
+  run_test("Truncated gzip", "tests/custom/truncated.json.gz", -1);
+  run_test("Gzip with a bad checksum", "tests/custom/bad_checksum.json.gz", -1);
+#ifdef HAVE_ZSTD
+  run_test("Zstd step 5 pass1", "tests/custom/pass1.json.zst", 0);
+  run_test("Zstd step 5 fail2", "tests/custom/fail2.json.zst", -1);
+#endif
+
+  run_index_test();
+
+  run_batch_test("Batch on one worker", 1);
+  run_batch_test("Batch on more workers than files", 1000);
+
+  run_sax_test("SAX events", "tests/step4/valid2.json", "{KSKNK{KS}K[S]}", 15);
+  run_sax_test("SAX batches", "tests/custom/2_million_ints_4M.json", NULL, 2000003);
+
+  run_in_place_test();
+
+  run_projection_test();
+
+  run_server_test();
+
+  run_perf_counter_test();
+
   return 0;
 }
 
 static void run_test(const char* testName, const char* jsonFilePath, const int expected) {
+  run_test_with_options(testName, jsonFilePath, expected, NULL);
+}
+
+static void run_test_with_options(const char* testName, const char* jsonFilePath, const int expected, const JsonOptions* opts) {
   printf("Running test %s on file %s\n...", testName, jsonFilePath);
 
-  FILE* fp = fopen(jsonFilePath, "r");
+  FILE* fp = OpenJsonInput(jsonFilePath);
   if (!fp) {
     fprintf(stderr, RED "run_test: failed to open file %s on test %s\n" RESET_COLOR, jsonFilePath, testName);
     return;
   }
 
-  TokenStream* ts = Tokenize(fp);  // tokenization
+  TokenStream* ts = TokenizeWithOptions(fp, opts);  // tokenization
   int actual = Parse(ts);          // parsing
 
+  // a stream that failed mid-way (e.g. corrupt compressed input) never held a valid document
+  if (ferror(fp)) {
+    fprintf(stderr, "run_test: read error on file %s\n", jsonFilePath);
+    actual = -1;
+  }
+
   if (actual == expected) {
     printf(GREEN "Test %s on file %s passed.\n" RESET_COLOR, testName, jsonFilePath);
     fclose(fp);
@@ -88,3 +215,622 @@ static void run_test(const char* testName, const char* jsonFilePath, const int e
     exit(-1);
   }
 }
+
+/**
+ * Validates step 5 (3 valid and 33 invalid files), a gzipped pass1 and a missing file
+ * as a batch, on at most `workers` threads, each file ending up with the status it would
+ * get on its own whether it was read ahead through io_uring or not.
+ */
+static void run_batch_test(const char* testName, size_t workers) {
+  printf("Running test %s on directory tests/step5\n...", testName);
+
+  PathList list = {0};
+  if (AddDirectory(&list, "tests/step5") == -1 || AddPath(&list, "tests/custom/pass1.json.gz") == -1 ||
+      AddPath(&list, "tests/custom/missing.json") == -1) {
+    fprintf(stderr, RED "run_batch_test: failed to list files on test %s\n" RESET_COLOR, testName);
+    exit(-1);
+  }
+
+  BatchSummary summary;
+  unsigned char* statuses = ValidateBatch(&list, workers, NULL, &summary);
+  char failed = !statuses || summary.valid != 4 || summary.invalid != 33 || summary.unreadable != 1 ||
+                summary.workers != (workers < list.count ? workers : list.count);
+  for (size_t i = 0; statuses && i < list.count; i++) {
+    char shouldPass = strstr(list.paths[i], "pass") != NULL;
+    char isMissing = strstr(list.paths[i], "missing") != NULL;
+    FileStatus expected = isMissing ? FILE_UNREADABLE : shouldPass ? FILE_VALID : FILE_INVALID;
+    if (statuses[i] != expected) {
+      fprintf(stderr, RED "run_batch_test: %s got status %d instead of %d\n" RESET_COLOR, list.paths[i], statuses[i], expected);
+      failed = 1;
+    }
+  }
+
+  if (failed) {
+    fprintf(stderr, RED "Test %s on directory tests/step5 FAILED. Got %zu valid, %zu invalid, %zu unreadable on %zu workers!\n" RESET_COLOR,
+            testName, summary.valid, summary.invalid, summary.unreadable, summary.workers);
+    exit(-1);
+  }
+  printf(GREEN "Test %s on directory tests/step5 passed.\n" RESET_COLOR, testName);
+  free(statuses);
+  FreePathList(&list);
+}
+
+/**
+ * Counts tokenizing and parsing the 2 million ints file, which must be timed whether
+ * or not this machine exposes hardware counters. The lexer reads it a byte at a time,
+ * so it cannot take fewer instructions than there are bytes. Its gzip copy must add
+ * the decompressing thread's instructions to tokenizing, and nothing to parsing
+ * once that thread exited.
+ */
+static void run_perf_counter_test(void) {
+  const char* jsonFilePath = "tests/custom/2_million_ints_4M.json";
+  printf("Running test Hardware counters on file %s\n...", jsonFilePath);
+
+  CounterSample plain[2];
+  CounterSample gzip[2];
+  size_t size = 0;
+  char haveCounters = 0;
+  char failed = count_phases(jsonFilePath, plain, &size, &haveCounters) == -1;
+  size_t gzipSize = 0;
+  failed |= count_phases("tests/custom/2_million_ints_4M.json.gz", gzip, &gzipSize, &haveCounters) == -1;
+  failed |= gzipSize != size;
+
+  for (size_t i = 0; i < COUNTER_KINDS; i++) {
+    failed |= !plain[0].available[i] && plain[0].values[i] != 0;
+  }
+  if (plain[0].available[COUNTER_INSTRUCTIONS] && gzip[0].available[COUNTER_INSTRUCTIONS]) {
+    failed |= plain[0].values[COUNTER_INSTRUCTIONS] < size;
+    failed |= gzip[0].values[COUNTER_INSTRUCTIONS] <= plain[0].values[COUNTER_INSTRUCTIONS];
+    failed |= gzip[1].values[COUNTER_INSTRUCTIONS] > 2 * plain[1].values[COUNTER_INSTRUCTIONS];
+  }
+
+  if (failed) {
+    fprintf(stderr,
+            RED "Test Hardware counters on file %s FAILED. Got %zu of %zu bytes, %" PRIu64 " instructions in %.3fs, %" PRIu64
+                " and %" PRIu64 " from gzip!\n" RESET_COLOR,
+            jsonFilePath, gzipSize, size, plain[0].values[COUNTER_INSTRUCTIONS], plain[0].seconds,
+            gzip[0].values[COUNTER_INSTRUCTIONS], gzip[1].values[COUNTER_INSTRUCTIONS]);
+    exit(-1);
+  }
+  printf(GREEN "Test Hardware counters on file %s passed%s.\n" RESET_COLOR, jsonFilePath, haveCounters ? "" : " (timing only)");
+}
+
+/**
+ * Counts the tokenize and parse phases of `jsonFilePath` into `phases`, opening
+ * the counters before the input like the CLI does, and stores the bytes tokenized in `size`.
+ *
+ * @returns 0 if the file is valid and both phases were timed, -1 otherwise
+ */
+static char count_phases(const char* jsonFilePath, CounterSample phases[2], size_t* size, char* haveCounters) {
+  PerfCounters counters;
+  *haveCounters = OpenPerfCounters(&counters) == 0;
+  FILE* fp = OpenJsonInput(jsonFilePath);
+  if (!fp) {
+    fprintf(stderr, RED "run_perf_counter_test: failed to open file %s\n" RESET_COLOR, jsonFilePath);
+    ClosePerfCounters(&counters);
+    return -1;
+  }
+
+  StartPerfCounters(&counters);
+  TokenStream* ts = Tokenize(fp);
+  StopPerfCounters(&counters, &phases[0]);
+  *size = TokenizedBytes();
+  StartPerfCounters(&counters);
+  int res = Parse(ts);
+  StopPerfCounters(&counters, &phases[1]);
+  ClosePerfCounters(&counters);
+  fclose(fp);
+
+  return res == 0 && phases[0].seconds > 0 && phases[1].seconds > 0 ? 0 : -1;
+}
+
+/**
+ * What `counting_alloc` and friends saw, every block they hand out being `malloc`'d
+ */
+typedef struct {
+  size_t allocs;
+  size_t frees;
+} AllocationCounts;
+
+/**
+ * Validates `jsonFilePath` with `opts` through a counting allocator, which must
+ * have been used and must get every block back whether or not the document is valid.
+ */
+static void run_allocator_test(const char* testName, const char* jsonFilePath, const int expected, JsonOptions opts) {
+  printf("Running test %s on file %s\n...", testName, jsonFilePath);
+
+  AllocationCounts counts = {0};
+  JsonAllocator counting = {counting_alloc, counting_realloc, counting_free, &counts};
+  opts.allocator = &counting;
+
+  FILE* fp = fopen(jsonFilePath, "r");
+  if (!fp) {
+    fprintf(stderr, RED "run_allocator_test: failed to open file %s on test %s\n" RESET_COLOR, jsonFilePath, testName);
+    exit(-1);
+  }
+  int actual = Parse(TokenizeWithOptions(fp, &opts));
+  fclose(fp);
+
+  if (actual != expected || counts.allocs == 0 || counts.allocs != counts.frees) {
+    fprintf(stderr, RED "Test %s on file %s FAILED. Expected %d, got %d with %zu allocations and %zu frees!\n" RESET_COLOR, testName,
+            jsonFilePath, expected, actual, counts.allocs, counts.frees);
+    exit(-1);
+  }
+  printf(GREEN "Test %s on file %s passed.\n" RESET_COLOR, testName, jsonFilePath);
+}
+
+static void* counting_alloc(void* ctx, size_t size) {
+  void* ptr = malloc(size);
+  if (ptr) ((AllocationCounts*)ctx)->allocs++;
+  return ptr;
+}
+
+static void* counting_realloc(void* ctx, void* ptr, size_t size) {
+  if (!ptr) return counting_alloc(ctx, size);
+  return realloc(ptr, size);
+}
+
+static void counting_free(void* ctx, void* ptr) {
+  ((AllocationCounts*)ctx)->frees++;
+  free(ptr);
+}
+
+/**
+ * Indexes the 2 million ints file (2000001 of them), whose element `n` is the `1` at byte `1 + 2n`,
+ * then checks seeking, sharding, that editing the file invalidates its index,
+ * that a header whose section sizes overflow is refused and that compressed files are not indexed.
+ */
+static void run_index_test(void) {
+  const char* jsonFilePath = "tests/custom/2_million_ints_4M.json";
+  const char* indexPath = "/tmp/json_parser_tests.jidx";
+  const char* scratchPath = "/tmp/json_parser_tests_scratch.json";
+  printf("Running test Sidecar index on file %s\n...", jsonFilePath);
+
+  char ok = WriteSidecarIndex(jsonFilePath, indexPath, NULL) == 0;
+  SidecarIndex* idx = ok ? OpenSidecarIndex(jsonFilePath, indexPath, NULL) : NULL;
+  ok = idx && SidecarElementCount(idx) == 2000001;
+
+  uint64_t probes[] = {0, 1, 255, 256, 257, 123456, 2000000};
+  for (size_t i = 0; ok && i < sizeof(probes) / sizeof(probes[0]); i++) {
+    uint64_t offset = 0;
+    ok = SidecarSeek(idx, probes[i], &offset) == 0 && offset == 1 + 2 * probes[i];
+  }
+  uint64_t unused = 0;
+  ok = ok && SidecarSeek(idx, 2000001, &unused) == -1;
+
+  Shard shards[7];
+  size_t n = ok ? SidecarShards(idx, 7, shards) : 0;
+  ok = ok && n == 7 && shards[0].begin == 1 && shards[n - 1].end == 4000002;
+  for (size_t i = 1; ok && i < n; i++) {
+    ok = shards[i].begin == shards[i - 1].end && shards[i].firstElement == shards[i - 1].firstElement + shards[i - 1].elementCount;
+  }
+  CloseSidecarIndex(idx);
+
+  // an index must not be used once the file it describes changes
+  FILE* fp = fopen(scratchPath, "w");
+  ok = ok && fp && fputs("[1, {\"a\": [2]}, \"]\"]", fp) >= 0;
+  if (fp) fclose(fp);
+  ok = ok && WriteSidecarIndex(scratchPath, indexPath, NULL) == 0;
+  idx = ok ? OpenSidecarIndex(scratchPath, indexPath, NULL) : NULL;
+  ok = ok && idx && SidecarElementCount(idx) == 3;
+  CloseSidecarIndex(idx);
+
+  fp = fopen(scratchPath, "a");
+  ok = ok && fp && fputs(" ", fp) >= 0;
+  if (fp) fclose(fp);
+  idx = ok ? OpenSidecarIndex(scratchPath, indexPath, NULL) : NULL;
+  ok = ok && !idx;
+  CloseSidecarIndex(idx);
+
+  // 2^60 more checkpoints wrap their 16 bytes each back to the same total size
+  ok = ok && WriteSidecarIndex(scratchPath, indexPath, NULL) == 0;
+  fp = ok ? fopen(indexPath, "r+b") : NULL;
+  uint64_t checkpointCount = 0;
+  ok = ok && fp && fseek(fp, 40, SEEK_SET) == 0 && fread(&checkpointCount, sizeof(checkpointCount), 1, fp) == 1;
+  checkpointCount += (uint64_t)1 << 60;
+  ok = ok && fseek(fp, 40, SEEK_SET) == 0 && fwrite(&checkpointCount, sizeof(checkpointCount), 1, fp) == 1;
+  if (fp) fclose(fp);
+  idx = ok ? OpenSidecarIndex(scratchPath, indexPath, NULL) : NULL;
+  ok = ok && !idx;
+  CloseSidecarIndex(idx);
+
+  // offsets into a compressed file could not be seeked to
+  ok = ok && WriteSidecarIndex("tests/custom/pass1.json.gz", indexPath, NULL) == -1;
+
+  remove(indexPath);
+  remove(scratchPath);
+
+  if (ok) {
+    printf(GREEN "Test Sidecar index on file %s passed.\n" RESET_COLOR, jsonFilePath);
+  } else {
+    fprintf(stderr, RED "Test Sidecar index on file %s FAILED.\n" RESET_COLOR, jsonFilePath);
+    exit(-1);
+  }
+}
+
+/**
+ * Parses `jsonFilePath` with a SAX handler and compares the events seen against
+ * `expectedEvents` (one char per event, see `collect_events`, skipped when `NULL`)
+ * and `expectedCount`, checking they came in full batches. Events must be streamed:
+ * the first of several batches arrives before the input was read to its end,
+ * and the whole parse fits in `SAX_MEMORY_LIMIT`.
+ */
+static void run_sax_test(const char* testName, const char* jsonFilePath, const char* expectedEvents, size_t expectedCount) {
+  printf("Running test %s on file %s\n...", testName, jsonFilePath);
+
+  FILE* fp = fopen(jsonFilePath, "r");
+  if (!fp) {
+    fprintf(stderr, RED "run_sax_test: failed to open file %s on test %s\n" RESET_COLOR, jsonFilePath, testName);
+    return;
+  }
+
+  SaxRecording rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.fp = fopen(jsonFilePath, "r");  // second handle to read token text through spans
+  rec.input = fp;
+  SaxHandler handler = {collect_events, &rec};
+  JsonOptions opts = {0};
+  opts.memoryLimit = SAX_MEMORY_LIMIT;
+
+  int actual = ParseStream(fp, &opts, &handler);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  if (rec.fp) fclose(rec.fp);
+
+  size_t expectedBatches = (expectedCount + SAX_BATCH_SIZE - 1) / SAX_BATCH_SIZE;
+  char ok = actual == 0 && rec.count == expectedCount && rec.batches == expectedBatches;
+  if (expectedBatches > 1) ok = ok && rec.readAtFirstBatch < size;
+  if (expectedEvents) {
+    ok = ok && strcmp(rec.events, expectedEvents) == 0 && strcmp(rec.firstKey, "\"key\"") == 0 && strcmp(rec.firstNumber, "101") == 0;
+  }
+
+  if (ok) {
+    printf(GREEN "Test %s on file %s passed.\n" RESET_COLOR, testName, jsonFilePath);
+  } else {
+    fprintf(stderr, RED "Test %s on file %s FAILED. Got %zu events in %zu batches: %s\n" RESET_COLOR, testName, jsonFilePath, rec.count, rec.batches, rec.events);
+    exit(-1);
+  }
+}
+
+static int collect_events(const SaxEvent* events, size_t count, void* ctx) {
+  static const char symbols[] = "{}[]KSNTFU";  // indexed by `SaxEventType`
+  SaxRecording* rec = (SaxRecording*)ctx;
+  if (rec->batches == 0) rec->readAtFirstBatch = ftell(rec->input);
+
+  for (size_t i = 0; i < count; i++) {
+    const SaxEvent* e = &events[i];
+    if (rec->count < MAX_RECORDED_EVENTS) {
+      rec->events[rec->count] = symbols[e->type];
+    }
+
+    char* text = NULL;
+    if (e->type == SAX_KEY && !rec->firstKey[0]) text = rec->firstKey;
+    if (e->type == SAX_NUMBER && !rec->firstNumber[0]) text = rec->firstNumber;
+    if (text && rec->fp && e->length < sizeof(rec->firstKey)) {
+      fseek(rec->fp, e->offset, SEEK_SET);
+      if (fread(text, 1, e->length, rec->fp) != e->length) text[0] = '\0';
+    }
+
+    rec->count++;
+  }
+
+  rec->batches++;
+  return 0;
+}
+
+/**
+ * Validates an array of identical records with unique keys, the last of them
+ * too big for a shape, so both the cached shapes and the general key set path
+ * run. With `repeatKey` that last record repeats its first key after the others.
+ */
+static void run_shape_test(const char* testName, char repeatKey) {
+  char* data = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&data, &len);
+  if (!out) {
+    fprintf(stderr, RED "Test %s FAILED to build its document.\n" RESET_COLOR, testName);
+    exit(-1);
+  }
+
+  fputc('[', out);
+  for (int r = 0; r < 100; r++) fprintf(out, "{\"id\": %d, \"name\": \"n\", \"tags\": {\"a\": 1}},", r);
+  fputc('{', out);
+  for (int k = 0; k < MAX_SHAPE_KEYS + 16; k++) fprintf(out, "\"k%d\": %d,", k, k);
+  fprintf(out, "\"%s\": 0}]", repeatKey ? "k0" : "last");
+  fclose(out);
+  printf("Running test %s\n...", testName);
+  FreeInternTable();  // start from no shapes and zeroed stats
+
+  JsonOptions uniqueKeys = {0};
+  uniqueKeys.rejectDuplicateKeys = 1;
+  FILE* fp = fmemopen(data, len, "r");
+  int res = fp ? Parse(TokenizeWithOptions(fp, &uniqueKeys)) : -1;
+  if (fp) fclose(fp);
+  free(data);
+
+  ShapeStats stats;
+  GetShapeStats(&stats);
+  FreeInternTable();
+
+  // the 4 keys of every record after the first follow the transitions cached by the one before,
+  // and no key takes more than the one shape step the lexer made for it
+  char ok = res == (repeatKey ? -1 : 0) && stats.cachedTransitions >= 99 * 4 && stats.predictedKeys >= 99 * 4 &&
+            stats.transitions <= stats.keys;
+  if (ok) {
+    printf(GREEN "Test %s passed.\n" RESET_COLOR, testName);
+  } else {
+    fprintf(stderr, RED "Test %s FAILED.\n" RESET_COLOR, testName);
+    exit(-1);
+  }
+}
+
+/**
+ * Validates an object of few but huge member names under a memory limit its tokens
+ * fit in many times over, so only interning its keys can exceed it. Then checks the
+ * table was reset for the next document rather than keeping what the failed one left,
+ * and that without a limit, the 10 MiB its keys take are not kept past the next document either.
+ */
+static void run_intern_budget_test(void) {
+  const size_t limit = 1 << 20;
+  char* data = NULL;
+  size_t len = 0;
+  FILE* out = open_memstream(&data, &len);
+  if (!out) {
+    fprintf(stderr, RED "Test Memory limit on interned keys FAILED to build its document.\n" RESET_COLOR);
+    exit(-1);
+  }
+
+  fputc('{', out);
+  for (int k = 0; k < 160; k++) {
+    fprintf(out, "%s\"k%02d", k > 0 ? "," : "", k);
+    for (int i = 0; i < (64 << 10); i++) fputc('x', out);
+    fprintf(out, "\": %d", k);
+  }
+  fputc('}', out);
+  fclose(out);
+  printf("Running test Memory limit on interned keys\n...");
+  FreeInternTable();
+
+  JsonOptions opts = {0};
+  opts.memoryLimit = limit;
+  FILE* fp = fmemopen(data, len, "r");
+  int allowed = fp ? Parse(TokenizeWithOptions(fp, &opts)) : -1;
+  if (fp) fclose(fp);
+
+  opts.rejectDuplicateKeys = 1;
+  fp = fmemopen(data, len, "r");
+  int unique = fp ? Parse(TokenizeWithOptions(fp, &opts)) : 0;
+  if (fp) fclose(fp);
+
+  fp = fopen("tests/step5/pass1.json", "r");
+  int next = fp ? Parse(TokenizeWithOptions(fp, &opts)) : -1;
+  if (fp) fclose(fp);
+  size_t tableBytes = InternTableBytes();
+
+  opts.memoryLimit = 0;
+  fp = fmemopen(data, len, "r");
+  int unlimited = fp ? Parse(TokenizeWithOptions(fp, &opts)) : -1;
+  if (fp) fclose(fp);
+  free(data);
+  size_t keptBytes = InternTableBytes();
+
+  fp = fopen("tests/step5/pass1.json", "r");
+  int after = fp ? Parse(TokenizeWithOptions(fp, &opts)) : -1;
+  if (fp) fclose(fp);
+  size_t resetBytes = InternTableBytes();
+  FreeInternTable();
+
+  if (allowed == 0 && unique == -1 && next == 0 && tableBytes <= limit && unlimited == 0 && after == 0 &&
+      keptBytes > (size_t)(10 << 20) && resetBytes <= limit) {
+    printf(GREEN "Test Memory limit on interned keys passed.\n" RESET_COLOR);
+  } else {
+    fprintf(stderr, RED "Test Memory limit on interned keys FAILED (%d %d %d %d %d, %zu %zu %zu table bytes).\n" RESET_COLOR, allowed,
+            unique, next, unlimited, after, tableBytes, keptBytes, resetBytes);
+    exit(-1);
+  }
+}
+
+/**
+ * Decoded strings, in document order, as seen by `collect_strings`
+ */
+typedef struct {
+  char* buf;
+  const char* strings[16];
+  size_t count;
+} InPlaceRecording;
+
+/**
+ * Parses a mutable buffer in place and checks every string was unescaped
+ * into it, NUL terminated, including surrogate pairs and strings long
+ * enough to go through the vectorized path, then that strings the lexer
+ * rejects are rejected while decoding them too.
+ */
+static void run_in_place_test(void) {
+  char buf[] =
+      "{\"k\\\"ey\": [\"a\\nb\", \"\\u00e9\\u20AC\", \"\\ud83d\\ude00\", \"\\udc00\","
+      " \"a plain string longer than 16 bytes\", \"16 bytes before\\tthe escape\\/and after it\"]}";
+  const char* expected[] = {"k\"ey", "a\nb", "\xc3\xa9\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xef\xbf\xbd",
+                            "a plain string longer than 16 bytes", "16 bytes before\tthe escape/and after it"};
+  size_t expectedCount = sizeof(expected) / sizeof(expected[0]);
+  printf("Running test In place parsing on an in-memory buffer\n...");
+
+  InPlaceRecording rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.buf = buf;
+  SaxHandler handler = {collect_strings, &rec};
+
+  char ok = ParseInPlace(buf, sizeof(buf) - 1, NULL, &handler) == 0 && rec.count == expectedCount;
+  for (size_t i = 0; ok && i < expectedCount; i++) {
+    ok = strcmp(rec.strings[i], expected[i]) == 0;
+  }
+
+  char control[] = "[\"a control character \x01 past the first 16 bytes\"]";
+  char badPair[] = "[\"\\ud83d\\u12zz\"]";
+  char unterminated[] = "[\"no closing quotation mark, long enough to vectorize]";
+  ok = ok && ParseInPlace(control, sizeof(control) - 1, NULL, NULL) == -1 && TokenizeErrorOffset() == 22 &&
+       ParseInPlace(badPair, sizeof(badPair) - 1, NULL, NULL) == -1 && TokenizeErrorOffset() == 12 &&
+       ParseInPlace(unterminated, sizeof(unterminated) - 1, NULL, NULL) == -1;
+
+  if (ok) {
+    printf(GREEN "Test In place parsing passed.\n" RESET_COLOR);
+  } else {
+    fprintf(stderr, RED "Test In place parsing FAILED.\n" RESET_COLOR);
+    exit(-1);
+  }
+}
+
+static int collect_strings(const SaxEvent* events, size_t count, void* ctx) {
+  InPlaceRecording* rec = (InPlaceRecording*)ctx;
+
+  for (size_t i = 0; i < count; i++) {
+    if (events[i].type != SAX_KEY && events[i].type != SAX_STRING) continue;
+    if (rec->count == sizeof(rec->strings) / sizeof(rec->strings[0])) return -1;
+
+    const char* text = rec->buf + events[i].offset;
+    if (text[events[i].length] != '\0') return -1;
+    rec->strings[rec->count++] = text;
+  }
+  return 0;
+}
+
+/**
+ * Rows `render_rows` saw, as `id,name,score;` with `-` for nulls
+ */
+typedef struct {
+  char text[256];
+  size_t len;
+  size_t rowGroups;
+} ProjectionRecording;
+
+/**
+ * Projects an NDJSON file with blank, invalid, nested, mistyped and
+ * duplicated fields into small row groups and checks every value, then
+ * again rejecting duplicate keys through a counting allocator, which drops
+ * the record repeating `id` and must get every block back.
+ */
+static void run_projection_test(void) {
+  const ColumnSpec specs[] = {{"id", COLUMN_INT64}, {"user.name", COLUMN_STRING}, {"user.score", COLUMN_DOUBLE}};
+  const char* expected = "1,ada,9.5;2,b\xc3\xa9" "a,-;-,-,3;4,-,-;6,line\nbreak,-100;9223372036854775807,-,-;";
+  printf("Running test Columnar projection on tests/custom/records.ndjson\n...");
+
+  ProjectionRecording rec;
+  memset(&rec, 0, sizeof(rec));
+  FILE* fp = fopen("tests/custom/records.ndjson", "r");
+  Projection* p = CreateProjection(specs, sizeof(specs) / sizeof(specs[0]), 4, NULL, render_rows, &rec);
+
+  char ok = fp && p && ProjectNdjson(p, fp) == 0 && ProjectedRows(p) == 6 && InvalidRecords(p) == 2 &&
+            rec.rowGroups == 2 && strcmp(rec.text, expected) == 0;
+  FreeProjection(p);
+
+  AllocationCounts counts = {0};
+  JsonAllocator counting = {counting_alloc, counting_realloc, counting_free, &counts};
+  JsonOptions opts = {0};
+  opts.rejectDuplicateKeys = 1;
+  opts.allocator = &counting;
+  const char* expectedUnique = "1,ada,9.5;2,b\xc3\xa9" "a,-;-,-,3;4,-,-;6,line\nbreak,-100;";
+
+  memset(&rec, 0, sizeof(rec));
+  if (fp) rewind(fp);
+  p = CreateProjection(specs, sizeof(specs) / sizeof(specs[0]), 4, &opts, render_rows, &rec);
+  ok = ok && p && ProjectNdjson(p, fp) == 0 && ProjectedRows(p) == 5 && InvalidRecords(p) == 3 &&
+       strcmp(rec.text, expectedUnique) == 0;
+  FreeProjection(p);
+  FreeInternTable();
+  ok = ok && counts.allocs > 0 && counts.allocs == counts.frees;
+  if (fp) fclose(fp);
+
+  if (ok) {
+    printf(GREEN "Test Columnar projection passed.\n" RESET_COLOR);
+  } else {
+    fprintf(stderr, RED "Test Columnar projection FAILED, got \"%s\".\n" RESET_COLOR, rec.text);
+    exit(-1);
+  }
+}
+
+static int render_rows(const Column* columns, size_t columnCount, size_t rows, void* ctx) {
+  ProjectionRecording* rec = (ProjectionRecording*)ctx;
+  rec->rowGroups++;
+
+  for (size_t row = 0; row < rows; row++) {
+    for (size_t i = 0; i < columnCount; i++) {
+      const Column* c = &columns[i];
+      size_t room = sizeof(rec->text) - rec->len;
+      int n;
+
+      if (!(c->validity[row / 8] & (1u << (row % 8)))) {
+        n = snprintf(rec->text + rec->len, room, "-");
+      } else if (c->spec.type == COLUMN_INT64) {
+        n = snprintf(rec->text + rec->len, room, "%lld", (long long)c->ints[row]);
+      } else if (c->spec.type == COLUMN_DOUBLE) {
+        n = snprintf(rec->text + rec->len, room, "%g", c->doubles[row]);
+      } else {
+        n = snprintf(rec->text + rec->len, room, "%.*s", (int)(c->stringOffsets[row + 1] - c->stringOffsets[row]),
+                     c->stringData + c->stringOffsets[row]);
+      }
+      if (n < 0 || (size_t)n + 1 >= room) return -1;
+      rec->len += n;
+      rec->text[rec->len++] = i + 1 < columnCount ? ',' : ';';
+      rec->text[rec->len] = '\0';
+    }
+  }
+  return 0;
+}
+
+#define TEST_SOCKET "/tmp/json_parser_tests.sock"
+
+static atomic_int stopTestServer = 0;
+
+/**
+ * Starts the validation server on a scratch socket and checks the
+ * replies to valid, unparsable and unlexable payloads, including
+ * the offsets they failed at.
+ */
+static void run_server_test(void) {
+  struct {
+    const char* payload;
+    Reply expected;
+  } cases[] = {
+      {"{\"a\": [1, 2, {\"b\": null}]}", {REPLY_VALID, 0}},
+      {"[1, 2,, 3]", {REPLY_INVALID, 6}},
+      {"[1, x]", {REPLY_INVALID, 4}},
+      {"[1, 2", {REPLY_INVALID, 5}},
+      {"", {REPLY_INVALID, 0}},
+  };
+  printf("Running test Validation server on " TEST_SOCKET "\n...");
+
+  pthread_t thread;
+  atomic_store(&stopTestServer, 0);
+  char started = pthread_create(&thread, NULL, serve_in_background, NULL) == 0;
+  char ok = started;
+
+  int fd = -1;
+  for (int attempt = 0; ok && fd == -1 && attempt < 100; attempt++) {
+    fd = ConnectToServer(TEST_SOCKET);
+    if (fd == -1) usleep(10000);
+  }
+  ok = ok && fd != -1;
+
+  for (size_t i = 0; ok && i < sizeof(cases) / sizeof(cases[0]); i++) {
+    Reply reply;
+    ok = RequestValidation(fd, cases[i].payload, strlen(cases[i].payload), &reply) == 0 &&
+         reply.status == cases[i].expected.status && reply.errorOffset == cases[i].expected.errorOffset;
+  }
+
+  if (fd != -1) close(fd);
+  atomic_store(&stopTestServer, 1);
+  if (started) pthread_join(thread, NULL);
+
+  if (ok) {
+    printf(GREEN "Test Validation server passed.\n" RESET_COLOR);
+  } else {
+    fprintf(stderr, RED "Test Validation server FAILED.\n" RESET_COLOR);
+    exit(-1);
+  }
+}
+
+static void* serve_in_background(void* arg) {
+  (void)arg;
+  ServeValidation(TEST_SOCKET, 2, NULL, &stopTestServer);
+  return NULL;
+}
@@ -0,0 +1,48 @@
+#ifndef SAX_H
+#define SAX_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAX_BATCH_SIZE 256  // events buffered before the handler is called
+
+/**
+ * Kinds of events `ParseWithHandler` and `ParseStream` report, in document order
+ */
+typedef enum {
+  SAX_START_OBJECT = 0,
+  SAX_END_OBJECT,
+  SAX_START_ARRAY,
+  SAX_END_ARRAY,
+  SAX_KEY,
+  SAX_STRING,
+  SAX_NUMBER,
+  SAX_TRUE,
+  SAX_FALSE,
+  SAX_NULL,
+} SaxEventType;
+
+/**
+ * One parser event. `offset` and `length` locate the token it came from in the
+ * JSON text (keys and strings include their quotation marks, escapes are left as is).
+ * `depth` is the nesting level: a container's own for its start and end events
+ * (1 for the root), and that of the enclosing container for keys and scalars.
+ */
+typedef struct {
+  uint32_t type;  // a `SaxEventType`
+  uint32_t depth;
+  size_t offset;
+  size_t length;
+} SaxEvent;
+
+/**
+ * Receives events in batches of up to `SAX_BATCH_SIZE`. `events` is only valid
+ * during the call. Returning nonzero stops parsing, which then fails.
+ */
+typedef int (*SaxBatchCallback)(const SaxEvent* events, size_t count, void* ctx);
+
+typedef struct {
+  SaxBatchCallback onEvents;
+  void* ctx;
+} SaxHandler;
+
+#endif
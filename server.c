@@ -0,0 +1,535 @@
+#define _GNU_SOURCE
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+
+#define MAX_EVENTS 64                  // epoll events handled per wakeup
+#define POLL_INTERVAL_MS 100           // how often the event loop checks `stop` when idle
+#define WRITE_TIMEOUT_MS 1000          // replies to clients that stop reading are abandoned after this
+#define INITIAL_BUFFER_SIZE 4096       // bytes a connection can hold before its first growth
+#define FRAME_HEADER_SIZE 4            // big endian payload length in front of every request
+
+/**
+ * A client connection. Bytes received but not answered yet are kept in `buf`.
+ * Armed with `EPOLLONESHOT`: the event loop owns it until it queues a request,
+ * then a single worker does until it hands it back through `JobQueue.done`.
+ */
+typedef struct Connection {
+  int fd;
+  char* buf;
+  size_t len;
+  size_t capacity;
+  struct Connection* prev;  // the event loop's list of open connections
+  struct Connection* next;
+  struct Connection* nextJob;  // `JobQueue` link
+  char hungUp;                 // set by a worker when the client must be dropped
+} Connection;
+
+/**
+ * Connections holding at least one complete request, waiting for a worker,
+ * and those the workers answered, waiting for the event loop to take them back
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  Connection* head;
+  Connection* tail;
+  Connection* done;
+  char shuttingDown;
+} JobQueue;
+
+/**
+ * State shared by the event loop and the workers of a `ServeValidation` call
+ */
+typedef struct {
+  int epollFd;
+  int wakeFd;  // eventfd the workers signal after adding to `queue.done`
+  const JsonOptions* opts;
+  JobQueue queue;
+  Connection* connections;
+} Server;
+
+static int listen_on(const char* socketPath);
+static char accept_connections(Server* server, int listenFd);
+static void handle_readable(Server* server, Connection* conn);
+static void close_connection(Server* server, Connection* conn);
+static char has_request(const Connection* conn);
+static void push_job(JobQueue* queue, Connection* conn);
+static Connection* pop_job(JobQueue* queue);
+static void* serve_worker(void* arg);
+static void serve_connection(Server* server, Connection* conn);
+static void give_back(Server* server, Connection* conn);
+static void take_back(Server* server);
+static void validate_payload(const char* payload, uint32_t len, const JsonOptions* opts, Reply* reply);
+static char rearm(Server* server, Connection* conn);
+static char write_all(int fd, const char* data, size_t len);
+static char read_all(int fd, char* data, size_t len);
+
+/**
+ * Listens on the Unix domain socket `socketPath` and validates the
+ * length-prefixed payloads clients send, answering each with a `Reply`
+ * in order. One thread multiplexes every connection with epoll and hands
+ * complete requests to `workers` threads. Every request is lexed into a
+ * fresh token stream and its key sets are freed once it is parsed; only a
+ * worker's interned keys outlive it, bounded like every thread's (see
+ * `TokenizeWithOptions`). Only the epoll thread touches epoll or closes
+ * connections, the workers hand theirs back.
+ * Runs until `*stop` becomes nonzero, then removes the socket.
+ *
+ * @returns 0 after a clean shutdown, -1 if the server could not start or its event loop failed
+ */
+int ServeValidation(const char* socketPath, size_t workers, const JsonOptions* opts, const atomic_int* stop) {
+  int res = -1;
+  int listenFd = -1;
+  size_t started = 0;
+  pthread_t* threads = NULL;
+  JsonOptions defaults = {0};
+
+  Server server;
+  memset(&server, 0, sizeof(server));
+  server.epollFd = -1;
+  server.wakeFd = -1;
+  server.opts = opts ? opts : &defaults;
+  pthread_mutex_init(&server.queue.lock, NULL);
+  pthread_cond_init(&server.queue.ready, NULL);
+
+  if (workers == 0) workers = 1;
+
+  listenFd = listen_on(socketPath);
+  if (listenFd == -1) goto on_cleanup;
+
+  server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+  server.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event listenEvent = {.events = EPOLLIN, .data.ptr = NULL};  // `NULL` marks the listening socket
+  struct epoll_event wakeEvent = {.events = EPOLLIN, .data.ptr = &server.wakeFd};
+  if (server.epollFd == -1 || server.wakeFd == -1 || epoll_ctl(server.epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent) == -1 ||
+      epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.wakeFd, &wakeEvent) == -1) {
+    fprintf(stderr, "ServeValidation: failed to set up epoll: %s\n", strerror(errno));
+    goto on_cleanup;
+  }
+
+  threads = (pthread_t*)malloc(workers * sizeof(pthread_t));
+  if (!threads) {
+    fprintf(stderr, "ServeValidation: failed to malloc worker threads!\n");
+    goto on_cleanup;
+  }
+  for (; started < workers; started++) {
+    if (pthread_create(&threads[started], NULL, serve_worker, &server) != 0) {
+      fprintf(stderr, "ServeValidation: failed to start worker %zu!\n", started);
+      goto on_cleanup;
+    }
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (!atomic_load(stop)) {
+    int n = epoll_wait(server.epollFd, events, MAX_EVENTS, POLL_INTERVAL_MS);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "ServeValidation: epoll_wait failed: %s\n", strerror(errno));
+      goto on_cleanup;
+    }
+
+    for (int i = 0; i < n; i++) {
+      Connection* conn = (Connection*)events[i].data.ptr;
+      if (!conn) {
+        if (accept_connections(&server, listenFd) == -1) goto on_cleanup;
+      } else if (events[i].data.ptr == &server.wakeFd) {
+        take_back(&server);
+      } else {
+        handle_readable(&server, conn);
+      }
+    }
+  }
+  res = 0;
+
+on_cleanup:
+  pthread_mutex_lock(&server.queue.lock);
+  server.queue.shuttingDown = 1;
+  pthread_cond_broadcast(&server.queue.ready);
+  pthread_mutex_unlock(&server.queue.lock);
+  for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  free(threads);
+
+  while (server.connections) close_connection(&server, server.connections);
+  if (server.epollFd != -1) close(server.epollFd);
+  if (server.wakeFd != -1) close(server.wakeFd);
+  if (listenFd != -1) {
+    close(listenFd);
+    unlink(socketPath);
+  }
+  pthread_cond_destroy(&server.queue.ready);
+  pthread_mutex_destroy(&server.queue.lock);
+  return res;
+}
+
+/**
+ * Opens a blocking connection to the server listening on `socketPath`.
+ *
+ * @returns the socket, or -1 on failure
+ */
+int ConnectToServer(const char* socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "ConnectToServer: socket path %s is too long!\n", socketPath);
+    return -1;
+  }
+  strcpy(addr.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) return -1;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Sends `payload` (`len` bytes) over the connection `fd` and waits for its `Reply`.
+ *
+ * @returns 0 on success, -1 if the connection failed
+ */
+int RequestValidation(int fd, const char* payload, uint32_t len, Reply* reply) {
+  uint32_t header = htonl(len);
+  if (write_all(fd, (const char*)&header, sizeof(header)) == -1 || write_all(fd, payload, len) == -1) return -1;
+
+  uint32_t wire[2];
+  if (read_all(fd, (char*)wire, sizeof(wire)) == -1) return -1;
+  reply->status = ntohl(wire[0]);
+  reply->errorOffset = ntohl(wire[1]);
+  return 0;
+}
+
+/**
+ * Binds a non-blocking listening socket to `socketPath`, replacing a stale socket file left there.
+ *
+ * @returns the socket, or -1 on failure
+ */
+static int listen_on(const char* socketPath) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "ServeValidation: socket path %s is too long!\n", socketPath);
+    return -1;
+  }
+  strcpy(addr.sun_path, socketPath);
+
+  struct stat st;
+  if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+    fprintf(stderr, "ServeValidation: failed to listen on %s: %s\n", socketPath, strerror(errno));
+    if (fd != -1) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Accepts every pending connection and registers it with epoll.
+ *
+ * @returns 0 on success, -1 if the listening socket failed
+ */
+static char accept_connections(Server* server, int listenFd) {
+  for (;;) {
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) return 0;
+      if (errno == EMFILE || errno == ENFILE) {
+        fprintf(stderr, "ServeValidation: out of file descriptors, retrying later\n");
+        return 0;
+      }
+      fprintf(stderr, "ServeValidation: accept failed: %s\n", strerror(errno));
+      return -1;
+    }
+
+    Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+    char* buf = (char*)malloc(INITIAL_BUFFER_SIZE);
+    if (!conn || !buf) {
+      fprintf(stderr, "ServeValidation: failed to allocate connection!\n");
+      free(conn);
+      free(buf);
+      close(fd);
+      continue;
+    }
+    conn->fd = fd;
+    conn->buf = buf;
+    conn->capacity = INITIAL_BUFFER_SIZE;
+
+    conn->next = server->connections;
+    if (server->connections) server->connections->prev = conn;
+    server->connections = conn;
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = conn};
+    if (epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) close_connection(server, conn);
+  }
+}
+
+/**
+ * Reads what `conn` sent, up to the end of its first request, and queues it
+ * for a worker once complete. Closes it when the client hung up.
+ */
+static void handle_readable(Server* server, Connection* conn) {
+  for (;;) {
+    // only buffer up to the end of the current request, so a pipelining client can't balloon memory
+    size_t wanted = FRAME_HEADER_SIZE;
+    if (conn->len >= FRAME_HEADER_SIZE) {
+      uint32_t header;
+      memcpy(&header, conn->buf, sizeof(header));
+      uint32_t payloadLen = ntohl(header);
+      if (payloadLen > MAX_PAYLOAD_SIZE) break;  // the worker turns it down
+      wanted += payloadLen;
+    }
+    if (conn->len >= wanted) break;
+
+    if (wanted > conn->capacity) {
+      char* grown = (char*)realloc(conn->buf, wanted);
+      if (!grown) {
+        fprintf(stderr, "ServeValidation: failed to grow connection buffer!\n");
+        close_connection(server, conn);
+        return;
+      }
+      conn->buf = grown;
+      conn->capacity = wanted;
+    }
+
+    ssize_t n = read(conn->fd, conn->buf + conn->len, wanted - conn->len);
+    if (n > 0) {
+      conn->len += n;
+      continue;
+    }
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+    close_connection(server, conn);  // hung up or failed
+    return;
+  }
+
+  if (has_request(conn)) {
+    push_job(&server->queue, conn);
+  } else if (rearm(server, conn) == -1) {
+    close_connection(server, conn);
+  }
+}
+
+static void close_connection(Server* server, Connection* conn) {
+  if (conn->prev) conn->prev->next = conn->next;
+  if (conn->next) conn->next->prev = conn->prev;
+  if (server->connections == conn) server->connections = conn->next;
+
+  close(conn->fd);  // also removes it from the epoll set
+  free(conn->buf);
+  free(conn);
+}
+
+/**
+ * @returns true if `conn` holds a complete request, or the header of one too large to accept
+ */
+static char has_request(const Connection* conn) {
+  if (conn->len < FRAME_HEADER_SIZE) return 0;
+
+  uint32_t header;
+  memcpy(&header, conn->buf, sizeof(header));
+  uint32_t payloadLen = ntohl(header);
+  return payloadLen > MAX_PAYLOAD_SIZE || conn->len - FRAME_HEADER_SIZE >= payloadLen;
+}
+
+static void push_job(JobQueue* queue, Connection* conn) {
+  pthread_mutex_lock(&queue->lock);
+  conn->nextJob = NULL;
+  if (queue->tail) {
+    queue->tail->nextJob = conn;
+  } else {
+    queue->head = conn;
+  }
+  queue->tail = conn;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Waits for a connection with a request.
+ *
+ * @returns it, or `NULL` once the server shuts down
+ */
+static Connection* pop_job(JobQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (!queue->head && !queue->shuttingDown) pthread_cond_wait(&queue->ready, &queue->lock);
+
+  Connection* conn = NULL;
+  if (!queue->shuttingDown) {
+    conn = queue->head;
+    queue->head = conn->nextJob;
+    if (!queue->head) queue->tail = NULL;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return conn;
+}
+
+static void* serve_worker(void* arg) {
+  Server* server = (Server*)arg;
+  Connection* conn;
+
+  while ((conn = pop_job(&server->queue)) != NULL) {
+    serve_connection(server, conn);
+  }
+
+  FreeInternTable();
+  FreeThreadPool();
+  return NULL;
+}
+
+/**
+ * Answers every complete request buffered in `conn`, then hands it back to the event loop.
+ * A connection that sent an oversized request or stopped reading is marked to be closed.
+ */
+static void serve_connection(Server* server, Connection* conn) {
+  while (has_request(conn)) {
+    uint32_t header;
+    memcpy(&header, conn->buf, sizeof(header));
+    uint32_t payloadLen = ntohl(header);
+
+    Reply reply = {REPLY_TOO_LARGE, 0};
+    if (payloadLen <= MAX_PAYLOAD_SIZE) validate_payload(conn->buf + FRAME_HEADER_SIZE, payloadLen, server->opts, &reply);
+
+    uint32_t wire[2] = {htonl(reply.status), htonl(reply.errorOffset)};
+    if (write_all(conn->fd, (const char*)wire, sizeof(wire)) == -1 || reply.status == REPLY_TOO_LARGE) {
+      conn->hungUp = 1;
+      break;
+    }
+
+    size_t consumed = FRAME_HEADER_SIZE + payloadLen;
+    memmove(conn->buf, conn->buf + consumed, conn->len - consumed);
+    conn->len -= consumed;
+  }
+
+  give_back(server, conn);
+}
+
+static void give_back(Server* server, Connection* conn) {
+  pthread_mutex_lock(&server->queue.lock);
+  conn->nextJob = server->queue.done;
+  server->queue.done = conn;
+  pthread_mutex_unlock(&server->queue.lock);
+
+  uint64_t one = 1;
+  if (write(server->wakeFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+    fprintf(stderr, "ServeValidation: failed to wake the event loop: %s\n", strerror(errno));
+  }
+}
+
+/**
+ * Re-arms every connection the workers handed back, or closes it if it was dropped.
+ */
+static void take_back(Server* server) {
+  uint64_t count;
+  if (read(server->wakeFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+    fprintf(stderr, "ServeValidation: failed to read wakeups: %s\n", strerror(errno));
+  }
+
+  pthread_mutex_lock(&server->queue.lock);
+  Connection* conn = server->queue.done;
+  server->queue.done = NULL;
+  pthread_mutex_unlock(&server->queue.lock);
+
+  while (conn) {
+    Connection* next = conn->nextJob;
+    if (conn->hungUp || rearm(server, conn) == -1) close_connection(server, conn);
+    conn = next;
+  }
+}
+
+/**
+ * Validates one request, recording where it failed in `reply`.
+ * Valid payloads, the common case, are lexed without spans; the few that fail
+ * parsing are lexed again with them to find the token the parser stopped at.
+ */
+static void validate_payload(const char* payload, uint32_t len, const JsonOptions* opts, Reply* reply) {
+  reply->status = REPLY_INVALID;
+  reply->errorOffset = 0;
+  if (len == 0) return;  // an empty text is not valid JSON
+
+  FILE* fp = fmemopen((void*)payload, len, "r");
+  if (!fp) {
+    fprintf(stderr, "ServeValidation: failed to open payload!\n");
+    return;
+  }
+
+  TokenStream* ts = TokenizeWithOptions(fp, opts);
+  if (!ts) {
+    reply->errorOffset = (uint32_t)TokenizeErrorOffset();
+  } else if (Parse(ts) != 0) {
+    JsonOptions withSpans = *opts;
+    withSpans.recordSpans = 1;
+    rewind(fp);
+    Parse(TokenizeWithOptions(fp, &withSpans));
+    reply->errorOffset = (uint32_t)ParseErrorOffset();
+  } else {
+    reply->status = REPLY_VALID;
+  }
+  fclose(fp);
+}
+
+static char rearm(Server* server, Connection* conn) {
+  struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = conn};
+  return epoll_ctl(server->epollFd, EPOLL_CTL_MOD, conn->fd, &ev) == -1 ? -1 : 0;
+}
+
+/**
+ * Writes all of `data`, waiting up to `WRITE_TIMEOUT_MS` whenever a non-blocking `fd` is full.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char write_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n > 0) {
+      data += n;
+      len -= n;
+      continue;
+    }
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+      if (poll(&pfd, 1, WRITE_TIMEOUT_MS) == 1) continue;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Reads exactly `len` bytes from the blocking `fd`.
+ *
+ * @returns 0 on success, -1 on failure or a closed connection
+ */
+static char read_all(int fd, char* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, data, len);
+    if (n > 0) {
+      data += n;
+      len -= n;
+      continue;
+    }
+    if (n == -1 && errno == EINTR) continue;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "options.h"
+
+#define MAX_PAYLOAD_SIZE (64u << 20)  // largest request the server accepts, larger ones get `REPLY_TOO_LARGE` and a closed connection
+
+/**
+ * Status of a `Reply`
+ */
+typedef enum {
+  REPLY_VALID = 0,
+  REPLY_INVALID,
+  REPLY_TOO_LARGE,
+} ReplyStatus;
+
+/**
+ * What the server answers to each request. On the wire both fields are
+ * 32 bit big endian, requests being a 32 bit big endian length followed by the payload.
+ * `errorOffset` is the byte offset validation stopped at, 0 for valid payloads.
+ */
+typedef struct {
+  uint32_t status;  // a `ReplyStatus`
+  uint32_t errorOffset;
+} Reply;
+
+int ServeValidation(const char* socketPath, size_t workers, const JsonOptions* opts, const atomic_int* stop);
+int ConnectToServer(const char* socketPath);
+int RequestValidation(int fd, const char* payload, uint32_t len, Reply* reply);
+
+#endif
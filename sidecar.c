@@ -0,0 +1,528 @@
+#include "sidecar.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "decompress.h"
+
+#define SIDECAR_MAGIC "JSIDX01"   // 7 chars plus the terminator fill the 8 byte `magic` field
+#define CHECKPOINT_INTERVAL 256   // every this many elements, an absolute offset is stored so seeks decode at most this many deltas
+#define SAMPLE_INTERVAL 64        // one of every this many containers nested below the top-level elements is sampled
+#define INITIAL_BYTES 4096        // bytes of varints to initially buffer while building an index
+
+/**
+ * On-disk layout, all integers in host byte order:
+ *
+ * `SidecarHeader`, then `checkpointCount` `Checkpoint`s, then `elementBytes` of
+ * varint deltas between consecutive element offsets (the first one relative to 0),
+ * then `sampleBytes` of (varint offset delta, varint depth) pairs.
+ */
+typedef struct {
+  char magic[8];
+  uint64_t fileSize;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  uint64_t elementCount;
+  uint64_t checkpointCount;
+  uint64_t elementBytes;
+  uint64_t sampleCount;
+  uint64_t sampleBytes;
+  uint64_t endOffset;  // offset of the top-level array's closing `]`
+} SidecarHeader;
+
+/**
+ * Absolute offset of element `n * CHECKPOINT_INTERVAL` and where its delta starts in the varint stream
+ */
+typedef struct {
+  uint64_t offset;
+  uint64_t byte;
+} Checkpoint;
+
+struct SidecarIndex {
+  const JsonAllocator* allocator;  // what the `SidecarIndex` itself was allocated with
+  void* map;
+  size_t mapSize;
+  const SidecarHeader* header;
+  const Checkpoint* checkpoints;
+  const unsigned char* elements;
+  const unsigned char* samples;
+};
+
+/**
+ * Growable byte buffer the varint streams are built in
+ */
+typedef struct {
+  unsigned char* data;
+  size_t len;
+  size_t capacity;
+  const JsonAllocator* allocator;
+} ByteBuffer;
+
+static char put_varint(ByteBuffer* buf, uint64_t value);
+static uint64_t get_varint(const unsigned char* data, uint64_t size, uint64_t* pos);
+static char put_checkpoint(Checkpoint** checkpoints, size_t* count, size_t* capacity, uint64_t offset, uint64_t byte,
+                           const JsonAllocator* allocator);
+static char scan_structure(const char* data, size_t size, SidecarHeader* header, ByteBuffer* elements, ByteBuffer* samples,
+                           Checkpoint** checkpoints, const JsonAllocator* allocator);
+static uint64_t first_element_at_or_after(const SidecarIndex* idx, uint64_t target, uint64_t* offset);
+static inline char is_whitespace(char ch);
+
+/**
+ * Builds the structural index of the JSON file at `jsonPath` and writes it to `indexPath`.
+ * The file must already be known to be valid JSON whose root is an array, stored
+ * uncompressed: offsets into a gzip or zstd stream could not be seeked to.
+ *
+ * The index records the byte offset of every top-level element (delta encoded,
+ * with an absolute checkpoint every `CHECKPOINT_INTERVAL` elements), a sample of
+ * the offsets of deeper containers, and the size and modification time of
+ * `jsonPath` so a stale index is detected on open. It is built in memory
+ * allocated through `allocator` (`NULL` for the C library).
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char WriteSidecarIndex(const char* jsonPath, const char* indexPath, const JsonAllocator* allocator) {
+  char res = -1;
+  void* map = MAP_FAILED;
+  ByteBuffer elements = {.allocator = allocator};
+  ByteBuffer samples = {.allocator = allocator};
+  Checkpoint* checkpoints = NULL;
+  char* tmpPath = NULL;
+  FILE* out = NULL;
+
+  int fd = open(jsonPath, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "WriteSidecarIndex: failed to open %s\n", jsonPath);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    fprintf(stderr, "WriteSidecarIndex: failed to stat %s or it is empty\n", jsonPath);
+    goto on_cleanup;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "WriteSidecarIndex: failed to mmap %s\n", jsonPath);
+    goto on_cleanup;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  if (IsCompressedJson(map, st.st_size)) {
+    fprintf(stderr, "WriteSidecarIndex: %s is compressed, only uncompressed files can be indexed\n", jsonPath);
+    goto on_cleanup;
+  }
+
+  SidecarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+  header.fileSize = st.st_size;
+  header.mtimeSec = st.st_mtim.tv_sec;
+  header.mtimeNsec = st.st_mtim.tv_nsec;
+
+  if (scan_structure((const char*)map, st.st_size, &header, &elements, &samples, &checkpoints, allocator) == -1) {
+    goto on_cleanup;
+  }
+
+  // write next to the target and rename, so readers never see a half written index
+  size_t pathLen = strlen(indexPath);
+  tmpPath = (char*)JsonAlloc(allocator, pathLen + 5);
+  if (!tmpPath) {
+    fprintf(stderr, "WriteSidecarIndex: failed to malloc path!\n");
+    goto on_cleanup;
+  }
+  memcpy(tmpPath, indexPath, pathLen);
+  memcpy(tmpPath + pathLen, ".tmp", 5);
+
+  out = fopen(tmpPath, "wb");
+  if (!out) {
+    fprintf(stderr, "WriteSidecarIndex: failed to create %s\n", tmpPath);
+    goto on_cleanup;
+  }
+
+  // the sections may be empty, and then their buffers were never allocated
+  if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+      (header.checkpointCount && fwrite(checkpoints, sizeof(Checkpoint), header.checkpointCount, out) != header.checkpointCount) ||
+      (elements.len && fwrite(elements.data, 1, elements.len, out) != elements.len) ||
+      (samples.len && fwrite(samples.data, 1, samples.len, out) != samples.len)) {
+    fprintf(stderr, "WriteSidecarIndex: failed to write %s\n", tmpPath);
+    goto on_cleanup;
+  }
+
+  if (fclose(out) != 0) {
+    out = NULL;
+    fprintf(stderr, "WriteSidecarIndex: failed to flush %s\n", tmpPath);
+    goto on_cleanup;
+  }
+  out = NULL;
+
+  if (rename(tmpPath, indexPath) == -1) {
+    fprintf(stderr, "WriteSidecarIndex: failed to rename %s to %s\n", tmpPath, indexPath);
+    goto on_cleanup;
+  }
+  res = 0;
+
+on_cleanup:
+  if (out) fclose(out);
+  if (res == -1 && tmpPath) unlink(tmpPath);
+  if (map != MAP_FAILED) munmap(map, st.st_size);
+  close(fd);
+  JsonFree(allocator, tmpPath);
+  JsonFree(allocator, elements.data);
+  JsonFree(allocator, samples.data);
+  JsonFree(allocator, checkpoints);
+  return res;
+}
+
+/**
+ * Maps the index at `indexPath` built for `jsonPath`.
+ *
+ * @returns `SidecarIndex` allocated through `allocator` on success, `NULL` if the index is
+ * missing, malformed, or stale (size or modification time of `jsonPath` changed)
+ */
+SidecarIndex* OpenSidecarIndex(const char* jsonPath, const char* indexPath, const JsonAllocator* allocator) {
+  struct stat jsonSt;
+  if (stat(jsonPath, &jsonSt) == -1) {
+    fprintf(stderr, "OpenSidecarIndex: failed to stat %s\n", jsonPath);
+    return NULL;
+  }
+
+  int fd = open(indexPath, O_RDONLY);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SidecarHeader)) {
+    fprintf(stderr, "OpenSidecarIndex: %s is not an index\n", indexPath);
+    close(fd);
+    return NULL;
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "OpenSidecarIndex: failed to mmap %s\n", indexPath);
+    return NULL;
+  }
+
+  // each section is bounded by what the file has left, so a crafted header cannot wrap the sum of their sizes
+  const SidecarHeader* header = (const SidecarHeader*)map;
+  uint64_t left = st.st_size - sizeof(SidecarHeader);
+  char sized = header->checkpointCount <= left / sizeof(Checkpoint);
+  if (sized) left -= header->checkpointCount * sizeof(Checkpoint);
+  sized = sized && header->elementBytes <= left;
+  if (sized) left -= header->elementBytes;
+  sized = sized && header->sampleBytes == left;
+
+  // every element has a delta of at least a byte and every sample two, plus a checkpoint per `CHECKPOINT_INTERVAL` elements
+  sized = sized && header->elementCount <= header->elementBytes && header->sampleCount <= header->sampleBytes / 2 &&
+          header->checkpointCount == header->elementCount / CHECKPOINT_INTERVAL + (header->elementCount % CHECKPOINT_INTERVAL != 0);
+
+  if (memcmp(header->magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0 || !sized) {
+    fprintf(stderr, "OpenSidecarIndex: %s is not an index\n", indexPath);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  if (header->fileSize != (uint64_t)jsonSt.st_size || header->mtimeSec != jsonSt.st_mtim.tv_sec || header->mtimeNsec != jsonSt.st_mtim.tv_nsec) {
+    fprintf(stderr, "OpenSidecarIndex: %s is stale, %s changed since it was built\n", indexPath, jsonPath);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  SidecarIndex* idx = (SidecarIndex*)JsonAlloc(allocator, sizeof(SidecarIndex));
+  if (!idx) {
+    fprintf(stderr, "OpenSidecarIndex: failed to malloc SidecarIndex!\n");
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  idx->allocator = allocator;
+  idx->map = map;
+  idx->mapSize = st.st_size;
+  idx->header = header;
+  idx->checkpoints = (const Checkpoint*)(header + 1);
+  idx->elements = (const unsigned char*)(idx->checkpoints + header->checkpointCount);
+  idx->samples = idx->elements + header->elementBytes;
+  return idx;
+}
+
+uint64_t SidecarElementCount(const SidecarIndex* idx) {
+  return idx ? idx->header->elementCount : 0;
+}
+
+/**
+ * Finds the byte offset of top-level element `n`, decoding at most
+ * `CHECKPOINT_INTERVAL` deltas past the nearest checkpoint.
+ *
+ * @returns 0 on success, -1 if `n` is out of range
+ */
+char SidecarSeek(const SidecarIndex* idx, uint64_t n, uint64_t* offset) {
+  if (!idx || n >= idx->header->elementCount) return -1;
+
+  const Checkpoint* cp = &idx->checkpoints[n / CHECKPOINT_INTERVAL];
+  uint64_t pos = cp->byte;
+  uint64_t current = cp->offset;
+  get_varint(idx->elements, idx->header->elementBytes, &pos);  // the checkpoint's own delta is already folded into `offset`
+
+  for (uint64_t i = n - n % CHECKPOINT_INTERVAL; i < n; i++) {
+    current += get_varint(idx->elements, idx->header->elementBytes, &pos);
+  }
+
+  *offset = current;
+  return 0;
+}
+
+/**
+ * Splits the top-level array into at most `k` byte ranges of roughly equal size,
+ * each starting and ending on element boundaries, written to `shards`.
+ * Fewer shards are produced when there are fewer elements than `k`
+ * or when single elements are larger than a fair share.
+ *
+ * @returns how many shards were written
+ */
+size_t SidecarShards(const SidecarIndex* idx, size_t k, Shard* shards) {
+  if (!idx || k == 0 || idx->header->elementCount == 0) return 0;
+
+  uint64_t firstOffset = 0;
+  SidecarSeek(idx, 0, &firstOffset);
+  uint64_t end = idx->header->endOffset;
+  uint64_t span = end - firstOffset;
+
+  size_t count = 0;
+  uint64_t begin = firstOffset;
+  uint64_t beginElement = 0;
+
+  for (size_t i = 1; i <= k; i++) {
+    uint64_t nextOffset = end;
+    uint64_t nextElement = idx->header->elementCount;
+
+    if (i < k) {
+      uint64_t target = firstOffset + span / k * i + span % k * i / k;
+      nextElement = first_element_at_or_after(idx, target, &nextOffset);
+    }
+    if (nextElement == beginElement) continue;  // this boundary fell inside the previous element
+
+    shards[count].begin = begin;
+    shards[count].end = nextOffset;
+    shards[count].firstElement = beginElement;
+    shards[count].elementCount = nextElement - beginElement;
+    count++;
+
+    begin = nextOffset;
+    beginElement = nextElement;
+  }
+
+  return count;
+}
+
+/**
+ * Decodes the next sampled nested container into `offset` and `depth`
+ * (1 for a container directly inside a top-level element).
+ *
+ * @returns 0 on success, -1 once every sample was visited
+ */
+char SidecarNextSample(const SidecarIndex* idx, SampleCursor* cursor, uint64_t* offset, uint32_t* depth) {
+  if (!idx || cursor->index >= idx->header->sampleCount) return -1;
+
+  cursor->offset += get_varint(idx->samples, idx->header->sampleBytes, &cursor->byte);
+  *offset = cursor->offset;
+  *depth = (uint32_t)get_varint(idx->samples, idx->header->sampleBytes, &cursor->byte);
+  cursor->index++;
+  return 0;
+}
+
+void CloseSidecarIndex(SidecarIndex* idx) {
+  if (!idx) {
+    return;
+  }
+  munmap(idx->map, idx->mapSize);
+  JsonFree(idx->allocator, idx);
+}
+
+/**
+ * Walks the (already validated) JSON text tracking only string boundaries
+ * and nesting depth, recording top-level element starts and sampled containers.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char scan_structure(const char* data, size_t size, SidecarHeader* header, ByteBuffer* elements, ByteBuffer* samples,
+                           Checkpoint** checkpoints, const JsonAllocator* allocator) {
+  size_t checkpointCapacity = 0;
+  size_t checkpointCount = 0;
+  uint64_t lastElement = 0;
+  uint64_t lastSample = 0;
+  uint64_t nestedContainers = 0;
+  size_t depth = 0;
+  char inString = 0;
+  char expectElement = 0;  // inside the root array, right after `[` or `,`
+
+  size_t i = 0;
+  while (i < size && is_whitespace(data[i])) i++;
+  if (i == size || data[i] != '[') {
+    fprintf(stderr, "WriteSidecarIndex: the root value must be an array\n");
+    return -1;
+  }
+
+  for (; i < size; i++) {
+    char ch = data[i];
+
+    if (inString) {
+      if (ch == '\\') i++;  // skip the escaped char, which may be a quotation mark
+      else if (ch == '"') inString = 0;
+      continue;
+    }
+    if (is_whitespace(ch)) continue;
+
+    if (depth == 1 && expectElement && ch != ']') {
+      if (header->elementCount % CHECKPOINT_INTERVAL == 0 &&
+          put_checkpoint(checkpoints, &checkpointCount, &checkpointCapacity, i, elements->len, allocator) == -1) {
+        return -1;
+      }
+      if (put_varint(elements, i - lastElement) == -1) return -1;
+      lastElement = i;
+      header->elementCount++;
+      expectElement = 0;
+    }
+
+    switch (ch) {
+      case '"':
+        inString = 1;
+        break;
+      case '[':
+      case '{':
+        depth++;
+        if (depth == 1) {
+          expectElement = 1;
+        } else if (depth > 2 && nestedContainers++ % SAMPLE_INTERVAL == 0) {
+          if (put_varint(samples, i - lastSample) == -1 || put_varint(samples, depth - 2) == -1) return -1;
+          lastSample = i;
+          header->sampleCount++;
+        }
+        break;
+      case ']':
+      case '}':
+        depth--;
+        if (depth == 0) {
+          header->endOffset = i;
+          header->checkpointCount = checkpointCount;
+          header->elementBytes = elements->len;
+          header->sampleBytes = samples->len;
+          return 0;
+        }
+        break;
+      case ',':
+        if (depth == 1) expectElement = 1;
+        break;
+      default:
+        break;
+    }
+  }
+
+  fprintf(stderr, "WriteSidecarIndex: unterminated root array\n");
+  return -1;
+}
+
+/**
+ * Binary searches the checkpoints, then decodes forward to the first element starting at or after `target`.
+ *
+ * @returns that element's index (the element count if there is none), with its offset in `offset`
+ */
+static uint64_t first_element_at_or_after(const SidecarIndex* idx, uint64_t target, uint64_t* offset) {
+  uint64_t lo = 0;
+  uint64_t hi = idx->header->checkpointCount;
+  while (hi - lo > 1) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (idx->checkpoints[mid].offset <= target) lo = mid;
+    else hi = mid;
+  }
+
+  uint64_t n = lo * CHECKPOINT_INTERVAL;
+  uint64_t pos = idx->checkpoints[lo].byte;
+  uint64_t current = idx->checkpoints[lo].offset;
+  get_varint(idx->elements, idx->header->elementBytes, &pos);
+
+  while (current < target) {
+    n++;
+    if (n == idx->header->elementCount) {
+      *offset = idx->header->endOffset;
+      return n;
+    }
+    current += get_varint(idx->elements, idx->header->elementBytes, &pos);
+  }
+
+  *offset = current;
+  return n;
+}
+
+/**
+ * Appends `value` as a LEB128 varint: 7 bits per byte, high bit set on all but the last.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+static char put_varint(ByteBuffer* buf, uint64_t value) {
+  if (buf->len + 10 > buf->capacity) {
+    size_t newCapacity = buf->capacity ? buf->capacity * 2 : INITIAL_BYTES;
+    unsigned char* temp = (unsigned char*)JsonRealloc(buf->allocator, buf->data, newCapacity);
+    if (!temp) {
+      fprintf(stderr, "WriteSidecarIndex: failed to realloc varint buffer!\n");
+      return -1;
+    }
+    buf->data = temp;
+    buf->capacity = newCapacity;
+  }
+
+  while (value >= 0x80) {
+    buf->data[buf->len++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  buf->data[buf->len++] = (unsigned char)value;
+  return 0;
+}
+
+/**
+ * Decodes the varint at `data[*pos]`, never reading past `data[size - 1]`:
+ * a corrupt index yields wrong offsets, not out of bounds reads.
+ */
+static uint64_t get_varint(const unsigned char* data, uint64_t size, uint64_t* pos) {
+  uint64_t value = 0;
+  int shift = 0;
+  unsigned char byte = 0;
+  do {
+    if (*pos >= size) return value;
+    byte = data[(*pos)++];
+    if (shift < 64) value |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+static char put_checkpoint(Checkpoint** checkpoints, size_t* count, size_t* capacity, uint64_t offset, uint64_t byte,
+                           const JsonAllocator* allocator) {
+  if (*count == *capacity) {
+    size_t newCapacity = *capacity ? *capacity * 2 : 64;
+    Checkpoint* temp = (Checkpoint*)JsonRealloc(allocator, *checkpoints, newCapacity * sizeof(Checkpoint));
+    if (!temp) {
+      fprintf(stderr, "WriteSidecarIndex: failed to realloc checkpoints!\n");
+      return -1;
+    }
+    *checkpoints = temp;
+    *capacity = newCapacity;
+  }
+
+  (*checkpoints)[*count].offset = offset;
+  (*checkpoints)[*count].byte = byte;
+  (*count)++;
+  return 0;
+}
+
+static inline char is_whitespace(char ch) {
+  return (ch == 0x20) || (ch == 0x09) || (ch == 0x0A) || (ch == 0x0D);
+}
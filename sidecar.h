@@ -0,0 +1,40 @@
+#ifndef SIDECAR_H
+#define SIDECAR_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+/**
+ * A byte range `[begin, end)` of the indexed JSON file. `begin` is the first
+ * byte of a top-level array element and `end` is either the first byte of a
+ * later element or the offset of the array's closing `]`, so a shard holds
+ * whole elements (plus the separators between them).
+ */
+typedef struct {
+  uint64_t begin;
+  uint64_t end;
+  uint64_t firstElement;
+  uint64_t elementCount;
+} Shard;
+
+/**
+ * Position of a `SidecarNextSample` walk. Zero-initialize it to start from the first sample.
+ */
+typedef struct {
+  uint64_t index;
+  uint64_t byte;
+  uint64_t offset;
+} SampleCursor;
+
+typedef struct SidecarIndex SidecarIndex;
+
+char WriteSidecarIndex(const char* jsonPath, const char* indexPath, const JsonAllocator* allocator);
+SidecarIndex* OpenSidecarIndex(const char* jsonPath, const char* indexPath, const JsonAllocator* allocator);
+uint64_t SidecarElementCount(const SidecarIndex* idx);
+char SidecarSeek(const SidecarIndex* idx, uint64_t n, uint64_t* offset);
+size_t SidecarShards(const SidecarIndex* idx, size_t k, Shard* shards);
+char SidecarNextSample(const SidecarIndex* idx, SampleCursor* cursor, uint64_t* offset, uint32_t* depth);
+void CloseSidecarIndex(SidecarIndex* idx);
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stdint.h>
 #include <stdio.h>
 
+#include "allocator.h"
+
 /**
  * JSON tokens per RFC definition
  */
@@ -22,15 +25,39 @@ typedef enum {
   LITERAL_NULL = 'U',
 } TOKEN;
 
+#define KEY_UNIQUE (1u << 31)      // on a `keyIds` entry the lexer's shape walk already proved unique in its object
+#define KEY_LEFT_SHAPE (1u << 30)  // on a `keyIds` entry holding the shape an object left, right before the key that left it
+#define KEY_ID_MASK (KEY_LEFT_SHAPE - 1)
+
+/**
+ * Byte range `[offset, offset + length)` of a token in the JSON text.
+ * Strings include their quotation marks.
+ */
+typedef struct {
+  size_t offset;
+  size_t length;
+} Span;
+
 /**
  * Represents the collected tokens from a JSON file.
  * Fields:
  * - `tokenArray` a pointer to `TOKEN`, showing JSON tokens in the order they were lexified
  * - `size` how large the array is
+ * - `spans` byte range of each token, parallel to `tokenArray` (`NULL` unless requested)
+ * - `keyIds` interned id of every object key, in the order they were lexified, flagged `KEY_UNIQUE`
+ *   or preceded by a `KEY_LEFT_SHAPE` entry (see `record_key`) (`NULL` unless requested)
+ * - `keyCount` how many entries `keyIds` has
+ * - `allocator` what every array above, and the stream itself, was allocated with
+ * - `budget` the stream's own `MemoryBudget` when `JsonOptions.memoryLimit` was set, `NULL` otherwise
  */
 typedef struct {
   TOKEN* tokenArray;
   size_t size;
+  Span* spans;
+  uint32_t* keyIds;
+  size_t keyCount;
+  const JsonAllocator* allocator;
+  MemoryBudget* budget;
 } TokenStream;
 
 #endif
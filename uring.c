@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * The submission and completion rings shared with the kernel, set up
+ * through the raw syscalls so no liburing is needed.
+ * The kernel moves `sqHead` and `cqTail`, this side `sqTail` and `cqHead`.
+ */
+struct Uring {
+  int fd;
+  unsigned entries;
+  unsigned queued;  // submission entries not yet handed to the kernel
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;  // same mapping as `sqRing` on kernels with `IORING_FEAT_SINGLE_MMAP`
+  size_t cqRingSize;
+  struct io_uring_sqe* sqes;
+  size_t sqesSize;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  struct io_uring_cqe* cqes;
+};
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags);
+
+/**
+ * Sets up a ring of `entries` submissions. io_uring is commonly missing or
+ * filtered out (old kernels, seccomp profiles of containers), so failing is
+ * silent: callers are expected to fall back to plain reads.
+ *
+ * @returns the ring, or `NULL` if io_uring is unavailable
+ */
+Uring* CreateUring(unsigned entries) {
+  Uring* ring = (Uring*)calloc(1, sizeof(Uring));
+  if (!ring) return NULL;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd == -1) {
+    free(ring);
+    return NULL;
+  }
+
+  ring->entries = params.sq_entries;
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  char singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap && ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) goto on_error;
+
+  if (singleMmap) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) goto on_error;
+  }
+
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                                          IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto on_error;
+
+  char* sq = (char*)ring->sqRing;
+  char* cq = (char*)ring->cqRing;
+  ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+  ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return ring;
+
+on_error:
+  FreeUring(ring);
+  return NULL;
+}
+
+/**
+ * Queues a read of `len` bytes from the start of `fd` into `buf`,
+ * completed under `tag` once `UringSubmit` handed it to the kernel.
+ *
+ * @returns 0 on success, -1 if the submission ring is full
+ */
+char UringQueueRead(Uring* ring, int fd, void* buf, size_t len, uint64_t tag) {
+  unsigned tail = *ring->sqTail;
+  unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+  if (tail - head == ring->entries) return -1;
+
+  unsigned idx = tail & *ring->sqMask;
+  struct io_uring_sqe* sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len > UINT32_MAX ? UINT32_MAX : (uint32_t)len;  // the rest comes as a short read
+  sqe->off = 0;
+  sqe->user_data = tag;
+
+  ring->sqArray[idx] = idx;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+  return 0;
+}
+
+/**
+ * Hands every queued read to the kernel without waiting for any of them.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char UringSubmit(Uring* ring) {
+  while (ring->queued > 0) {
+    int submitted = uring_enter(ring->fd, ring->queued, 0, 0);
+    if (submitted == -1) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+      fprintf(stderr, "UringSubmit: io_uring_enter failed: %s\n", strerror(errno));
+      return -1;
+    }
+    ring->queued -= submitted;
+  }
+  return 0;
+}
+
+/**
+ * Waits for the next completed read.
+ * `res` is the number of bytes read, or a negated `errno`.
+ *
+ * @returns 0 on success, -1 on failure
+ */
+char UringWait(Uring* ring, uint64_t* tag, int* res) {
+  for (;;) {
+    unsigned head = *ring->cqHead;
+    if (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cqMask];
+      *tag = cqe->user_data;
+      *res = cqe->res;
+      __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+
+    if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      fprintf(stderr, "UringWait: io_uring_enter failed: %s\n", strerror(errno));
+      return -1;
+    }
+  }
+}
+
+void FreeUring(Uring* ring) {
+  if (!ring) return;
+  if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqRing && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) munmap(ring->cqRing, ring->cqRingSize);
+  if (ring->sqRing && ring->sqRing != MAP_FAILED) munmap(ring->sqRing, ring->sqRingSize);
+  close(ring->fd);
+  free(ring);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
@@ -0,0 +1,17 @@
+#ifndef URING_H
+#define URING_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Opaque io_uring instance used to read files ahead of validation
+ */
+typedef struct Uring Uring;
+
+Uring* CreateUring(unsigned entries);
+char UringQueueRead(Uring* ring, int fd, void* buf, size_t len, uint64_t tag);
+char UringSubmit(Uring* ring);
+char UringWait(Uring* ring, uint64_t* tag, int* res);
+void FreeUring(Uring* ring);
+
+#endif